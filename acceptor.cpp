@@ -0,0 +1,92 @@
+#include "acceptor.h"
+#include <fcntl.h>
+#include <cstring>
+#include <exception>
+
+// start shedding a little before the table is full, fds are also used for files being mapped.
+static const int RESERVED_FDS = 32;
+
+std::atomic<unsigned long> acceptor::m_accepted(0);
+std::atomic<unsigned long> acceptor::m_shed(0);
+std::atomic<unsigned long> acceptor::m_emfile(0);
+
+acceptor::acceptor(int listenfd, int max_fd, int budget):
+        m_listenfd(listenfd), m_max_fd(max_fd), m_budget(budget), m_spare_fd(-1) {
+    if (budget <= 0) {
+        throw std::exception();
+    }
+    m_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+acceptor::~acceptor() {
+    if (m_spare_fd >= 0) close(m_spare_fd);
+}
+
+bool acceptor::overloaded(int connfd) const {
+    return connfd >= m_max_fd || http_conn::m_user_count >= m_max_fd - RESERVED_FDS;
+}
+
+bool acceptor::admit(int connfd) {
+    if (overloaded(connfd)) {
+        // write the client a message that the server is busy.
+        shed(connfd);
+        return false;
+    }
+    m_accepted++;
+    return true;
+}
+
+void acceptor::shed(int connfd) {
+    http_conn::send_busy(connfd);
+    close(connfd);
+    m_shed++;
+}
+
+// Without a free fd the pending connection stays in the backlog and the edge-triggered
+// listenfd never fires again for it. Release the spare fd, take the connection and refuse it.
+bool acceptor::handle_emfile() {
+    m_emfile++;
+    if (m_spare_fd < 0) return false;
+    close(m_spare_fd);
+    int connfd = accept4(m_listenfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (connfd >= 0) shed(connfd);
+    m_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return connfd >= 0;
+}
+
+void acceptor::print_stats() {
+    printf("accept: accepted %lu, shed %lu, emfile %lu.\n",
+           m_accepted.load(), m_shed.load(), m_emfile.load());
+}
+
+int open_listenfd(int port, bool reuseport, int backlog) {
+    // monitor socket
+    int listenfd = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenfd < 0) return -1;
+
+    // Port multiplexing
+    int reuse = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+    if (reuseport && setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof reuse) != 0) {
+        close(listenfd);
+        return -1;
+    }
+
+    // Bind
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY; // any address
+    address.sin_port = htons(port); // host to network sequence
+    if (bind(listenfd, (struct sockaddr*)&address, sizeof address) != 0) {
+        close(listenfd);
+        return -1;
+    }
+
+    // Monitor, the kernel caps the backlog at net.core.somaxconn.
+    if (listen(listenfd, backlog) != 0) {
+        close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
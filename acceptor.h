@@ -0,0 +1,81 @@
+#ifndef WEBSERVER_ACCEPTOR_H
+#define WEBSERVER_ACCEPTOR_H
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <atomic>
+#include "http_conn.h"
+
+/*
+ * class acceptor
+ * Drains the backlog of an edge-triggered listening socket with accept4().
+ * At most `budget` connections are taken per call so a burst cannot starve
+ * the other events of the loop; accept_conns() returns false if it stopped
+ * on the budget and the loop has to call it again without waiting for a new
+ * epoll event. Connections beyond the limit get a canned 503 and are closed.
+ */
+class acceptor {
+public:
+    static const int DEFAULT_BACKLOG = 1024;
+    static const int DEFAULT_BUDGET = 64;
+
+    acceptor(int listenfd, int max_fd, int budget = DEFAULT_BUDGET);
+    ~acceptor();
+
+    // handler(connfd, address) is called for every accepted connection.
+    template<typename F>
+    bool accept_conns(F handler);
+    // for connections accepted elsewhere (io_uring multishot accept), false if it was shed.
+    bool admit(int connfd);
+
+    static void print_stats();
+
+public:
+    static std::atomic<unsigned long> m_accepted; // handed to a handler.
+    static std::atomic<unsigned long> m_shed; // answered with 503, connection table (nearly) full.
+    static std::atomic<unsigned long> m_emfile; // out of file descriptors.
+
+private:
+    bool overloaded(int connfd) const;
+    void shed(int connfd);
+    bool handle_emfile(); // false if there was no connection to refuse.
+
+private:
+    int m_listenfd;
+    int m_max_fd;
+    int m_budget;
+    int m_spare_fd; // given up on EMFILE so the pending connection can be accepted and refused.
+};
+
+// create a listening socket on port. With reuseport several sockets can be bound to the same port
+// and the kernel spreads incoming connections between them.
+int open_listenfd(int port, bool reuseport, int backlog = acceptor::DEFAULT_BACKLOG);
+
+template<typename F>
+bool acceptor::accept_conns(F handler) {
+    for(int i = 0; i < m_budget; i++) {
+        struct sockaddr_in client_address;
+        socklen_t client_addrlen = sizeof(client_address);
+        int connfd = accept4(m_listenfd, (struct sockaddr*) &client_address, &client_addrlen,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (connfd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true; // backlog drained
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                if (!handle_emfile()) return true;
+                continue;
+            }
+            printf("accept failure: %d.\n", errno);
+            return true;
+        }
+
+        if (!admit(connfd)) continue;
+        handler(connfd, client_address);
+    }
+    return false;
+}
+
+#endif //WEBSERVER_ACCEPTOR_H
@@ -0,0 +1,69 @@
+#include "crlf_scan.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CRLF_SCAN_X86
+#endif
+
+const char* find_line_end_scalar(const char *begin, const char *end) {
+    for(const char *p = begin; p < end; p++) {
+        if (*p == '\r' || *p == '\n') return p;
+    }
+    return end;
+}
+
+#ifdef CRLF_SCAN_X86
+// compare 16 bytes at once against '\r' and '\n', one bit per matching byte.
+__attribute__((target("sse2")))
+static const char* scan_sse2(const char *p, const char *end) {
+    const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+    for(; end - p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return find_line_end_scalar(p, end);
+}
+
+// most header lines are shorter than 32 bytes: look at the first 16 with SSE2, then go on in
+// steps of 32.
+__attribute__((target("avx2")))
+static const char* scan_avx2(const char *p, const char *end) {
+    if (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+    for(; end - p >= 32; p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) p);
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                                                                        _mm256_cmpeq_epi8(v, lf)));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return scan_sse2(p, end);
+}
+
+static bool cpu_has(bool avx2) {
+    __builtin_cpu_init(); // we may run before the constructors that would do it.
+    return avx2 ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("sse2");
+}
+
+const line_end_finder find_line_end_sse2 = cpu_has(false) ? scan_sse2 : nullptr;
+const line_end_finder find_line_end_avx2 = cpu_has(true) ? scan_avx2 : nullptr;
+#else
+const line_end_finder find_line_end_sse2 = nullptr;
+const line_end_finder find_line_end_avx2 = nullptr;
+#endif
+
+// SSE2 even where AVX2 runs: on request heads as they come, lines of ~40 bytes, AVX2 is slower
+// (see parse_bench), it only wins on lines of hundreds of bytes.
+static line_end_finder pick() {
+#ifdef CRLF_SCAN_X86
+    if (cpu_has(false)) return scan_sse2;
+#endif
+    return find_line_end_scalar;
+}
+
+const line_end_finder find_line_end_impl = pick();
@@ -0,0 +1,21 @@
+#ifndef WEBSERVER_CRLF_SCAN_H
+#define WEBSERVER_CRLF_SCAN_H
+
+// Line terminator search for the HTTP parser: the first '\r' or '\n' in [begin, end), end if
+// there is none. The SSE2 version (16 bytes per step) is picked at startup where the cpu has it,
+// the scalar one is used elsewhere and for the tails. The AVX2 one (32 bytes) is only for the
+// benchmark: it loses to SSE2 on header lines of typical length.
+typedef const char* (*line_end_finder)(const char *begin, const char *end);
+
+extern const line_end_finder find_line_end_impl;
+
+inline const char* find_line_end(const char *begin, const char *end) {
+    return find_line_end_impl(begin, end);
+}
+
+// the variants, for the benchmark. The SIMD ones are nullptr where they can't run.
+const char* find_line_end_scalar(const char *begin, const char *end);
+extern const line_end_finder find_line_end_sse2;
+extern const line_end_finder find_line_end_avx2;
+
+#endif //WEBSERVER_CRLF_SCAN_H
@@ -0,0 +1,355 @@
+#include "file_cache.h"
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+
+std::atomic<unsigned long> file_cache::m_hits(0);
+std::atomic<unsigned long> file_cache::m_misses(0);
+std::atomic<unsigned long> file_cache::m_evictions(0);
+std::atomic<unsigned long> file_cache::m_invalidations(0);
+std::atomic<long> file_cache::m_entries(0);
+std::atomic<long> file_cache::m_bytes(0);
+
+// what a change of a name in a watched directory, or of the directory itself, looks like.
+static const uint32_t WATCH_MASK = IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE
+                                   | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+
+file_cache::file_cache(long budget, long inline_size):
+        m_shard_budget(budget / SHARDS), m_inline_size(inline_size), m_inotifyfd(-1), m_running(false),
+        m_watch_locker("file cache watches") {
+    if (budget <= 0) {
+        throw std::exception();
+    }
+}
+
+file_cache::~file_cache() {
+    if (m_running) {
+        pthread_cancel(m_thread);
+        pthread_join(m_thread, nullptr);
+    }
+    invalidate_all();
+    if (m_inotifyfd >= 0) close(m_inotifyfd);
+}
+
+bool file_cache::start() {
+    m_inotifyfd = inotify_init1(IN_CLOEXEC);
+    if (m_inotifyfd < 0) return false;
+    if (pthread_create(&m_thread, nullptr, worker, this) != 0) {
+        close(m_inotifyfd);
+        m_inotifyfd = -1;
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void file_cache::print_stats() {
+    unsigned long hits = m_hits.load(), misses = m_misses.load();
+    printf("file cache: hits %lu, misses %lu (%.1f%% hits), evicted %lu, invalidated %lu, %ld files, %ld bytes.\n",
+           hits, misses, hits + misses ? 100.0 * hits / (hits + misses) : 0.0, m_evictions.load(),
+           m_invalidations.load(), m_entries.load(), m_bytes.load());
+}
+
+bool file_cache::normalize(const char *path, std::string &key) {
+    key.clear();
+    for(const char *p = path; *p; ) {
+        if (p[0] == '/' && p[1] == '/') {
+            p++;
+        } else if (p[0] == '/' && p[1] == '.' && (p[2] == '/' || p[2] == '\0')) {
+            p += 2;
+        } else if (p[0] == '/' && p[1] == '.' && p[2] == '.' && (p[3] == '/' || p[3] == '\0')) {
+            return false; // lexically wrong if a symbolic link is on the way.
+        } else {
+            key += *p++;
+        }
+    }
+    return !key.empty();
+}
+
+file_cache::shard& file_cache::shard_of(const std::string &key) {
+    return m_shards[std::hash<std::string>()(key) % SHARDS];
+}
+
+long file_cache::charge(const entry *e) {
+    return (long) (sizeof(entry) + e->path.size()) + (e->address ? (long) e->st.st_size : 0)
+           + (e->data ? (long) e->st.st_size : 0);
+}
+
+void file_cache::push_front(shard &s, entry *e) {
+    e->prev = nullptr;
+    e->next = s.m_head;
+    if (s.m_head) s.m_head->prev = e;
+    s.m_head = e;
+    if (!s.m_tail) s.m_tail = e;
+}
+
+void file_cache::unlink(shard &s, entry *e) {
+    if (e->prev) e->prev->next = e->next;
+    else s.m_head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else s.m_tail = e->prev;
+    e->prev = e->next = nullptr;
+    s.m_entries.erase(e->path);
+    e->cached = false;
+    long bytes = charge(e);
+    s.m_bytes -= bytes;
+    s.m_count--;
+    m_bytes -= bytes;
+    m_entries--;
+}
+
+file_cache::entry* file_cache::evict(shard &s) {
+    entry *evicted = nullptr;
+    while(s.m_tail && (s.m_bytes > m_shard_budget || s.m_count > MAX_ENTRIES / SHARDS)) {
+        entry *e = s.m_tail;
+        unlink(s, e);
+        e->next = evicted;
+        evicted = e;
+        m_evictions++;
+    }
+    return evicted;
+}
+
+// outside of the shard lock: the last reference may close and unmap.
+void file_cache::release_chain(entry *e) {
+    while(e) {
+        entry *next = e->next;
+        release(e);
+        e = next;
+    }
+}
+
+void file_cache::destroy(entry *e) {
+    if (e->address) munmap(e->address, e->st.st_size);
+    delete [] e->data;
+    close(e->fd);
+    delete e;
+}
+
+file_cache::entry* file_cache::acquire(const char *path) {
+    std::string key;
+    if (!normalize(path, key)) return nullptr;
+    shard &s = shard_of(key);
+
+    s.m_locker.lock();
+    auto it = s.m_entries.find(key);
+    if (it != s.m_entries.end()) {
+        entry *e = it->second;
+        e->refs++;
+        if (s.m_head != e) {
+            // most recently used, without touching the map.
+            e->prev->next = e->next;
+            if (e->next) e->next->prev = e->prev;
+            else s.m_tail = e->prev;
+            push_front(s, e);
+        }
+        s.m_locker.unlock();
+        m_hits++;
+        return e;
+    }
+    unsigned long generation = s.m_generation;
+    s.m_locker.unlock();
+    m_misses++;
+
+    // the watch first, so a change after the open is seen.
+    if (!watch(key)) return nullptr;
+    int fd = open(key.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    auto *e = new entry;
+    if (fstat(fd, &e->st) < 0 || !S_ISREG(e->st.st_mode) || !(e->st.st_mode & S_IROTH)) {
+        close(fd);
+        delete e;
+        return nullptr;
+    }
+    e->path = key;
+    e->fd = fd;
+    e->address = nullptr;
+    e->data = nullptr;
+    if (e->st.st_size > 0 && e->st.st_size < m_inline_size) {
+        e->data = new char[e->st.st_size];
+        off_t done = 0;
+        while(done < e->st.st_size) {
+            ssize_t n = pread(fd, e->data + done, e->st.st_size - done, done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break; // shorter than the stat says, it is being written.
+            done += n;
+        }
+        if (done < e->st.st_size) {
+            destroy(e);
+            return nullptr;
+        }
+    }
+    e->refs = 1;
+    e->cached = false;
+    e->prev = e->next = nullptr;
+
+    s.m_locker.lock();
+    if (s.m_generation != generation) {
+        // invalidated while it was opened, maybe this very file: serve it, don't keep it.
+        s.m_locker.unlock();
+        return e;
+    }
+    auto inserted = s.m_entries.emplace(key, e);
+    if (!inserted.second) {
+        // another thread was first.
+        entry *first = inserted.first->second;
+        first->refs++;
+        s.m_locker.unlock();
+        destroy(e);
+        return first;
+    }
+    e->refs++;
+    e->cached = true;
+    push_front(s, e);
+    long bytes = charge(e);
+    s.m_bytes += bytes;
+    s.m_count++;
+    m_bytes += bytes;
+    m_entries++;
+    entry *evicted = evict(s);
+    s.m_locker.unlock();
+    release_chain(evicted);
+    return e;
+}
+
+bool file_cache::peek(const char *path, off_t &size) {
+    std::string key;
+    if (!normalize(path, key)) return false;
+    shard &s = shard_of(key);
+    s.m_locker.lock();
+    auto it = s.m_entries.find(key);
+    bool found = it != s.m_entries.end();
+    if (found) size = it->second->st.st_size;
+    s.m_locker.unlock();
+    return found;
+}
+
+void file_cache::release(entry *e) {
+    if (e->refs.fetch_sub(1) == 1) destroy(e);
+}
+
+bool file_cache::mappable(const entry *e) const {
+    return e->address || charge(e) + e->st.st_size <= m_shard_budget;
+}
+
+char* file_cache::map(entry *e) {
+    shard &s = shard_of(e->path);
+    entry *evicted = nullptr;
+    s.m_locker.lock();
+    if (!e->address && e->st.st_size > 0) {
+        void *address = mmap(nullptr, e->st.st_size, PROT_READ, MAP_SHARED, e->fd, 0);
+        if (address != MAP_FAILED) {
+            e->address = (char*) address;
+            if (e->cached) {
+                s.m_bytes += e->st.st_size;
+                m_bytes += e->st.st_size;
+                evicted = evict(s);
+            }
+        }
+    }
+    char *address = e->address;
+    s.m_locker.unlock();
+    release_chain(evicted);
+    return address;
+}
+
+void file_cache::invalidate(const std::string &key) {
+    shard &s = shard_of(key);
+    entry *e = nullptr;
+    s.m_locker.lock();
+    s.m_generation++;
+    auto it = s.m_entries.find(key);
+    if (it != s.m_entries.end()) {
+        e = it->second;
+        unlink(s, e);
+        m_invalidations++;
+    }
+    s.m_locker.unlock();
+    if (e) release(e);
+}
+
+void file_cache::invalidate_all() {
+    for(auto &s : m_shards) {
+        s.m_locker.lock();
+        s.m_generation++;
+        entry *dropped = nullptr;
+        while(s.m_head) {
+            entry *e = s.m_head;
+            unlink(s, e);
+            e->next = dropped;
+            dropped = e;
+            m_invalidations++;
+        }
+        s.m_locker.unlock();
+        release_chain(dropped);
+    }
+}
+
+bool file_cache::watch(const std::string &key) {
+    if (m_inotifyfd < 0) return false;
+    size_t slash = key.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : key.substr(0, slash);
+    m_watch_locker.lock();
+    bool watched = m_watched.count(dir) > 0;
+    if (!watched) {
+        int wd = inotify_add_watch(m_inotifyfd, dir.c_str(), WATCH_MASK);
+        if (wd >= 0) {
+            m_watches[wd].push_back(dir);
+            m_watched[dir] = wd;
+            watched = true;
+        }
+    }
+    m_watch_locker.unlock();
+    return watched;
+}
+
+void* file_cache::worker(void *arg) {
+    auto *cache = (file_cache*) arg;
+    cache->run();
+    return cache;
+}
+
+void file_cache::run() {
+    alignas(struct inotify_event) char buf[4096];
+    while(true) {
+        ssize_t len = read(m_inotifyfd, buf, sizeof buf);
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            printf("inotify failure: %d, the file cache is dropped.\n", errno);
+            invalidate_all();
+            break;
+        }
+        for(char *p = buf; p < buf + len; ) {
+            auto *event = (struct inotify_event*) p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                // events were lost.
+                invalidate_all();
+                continue;
+            }
+            std::vector<std::string> dirs;
+            m_watch_locker.lock();
+            auto it = m_watches.find(event->wd);
+            if (it != m_watches.end()) {
+                dirs = it->second;
+                if (event->mask & IN_IGNORED) {
+                    // the watch is gone with the directory, watch it again when a file in it is opened.
+                    for(auto &dir : dirs) m_watched.erase(dir);
+                    m_watches.erase(it);
+                }
+            }
+            m_watch_locker.unlock();
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                // every file below may be another one now.
+                invalidate_all();
+            } else if (event->len > 0) {
+                for(auto &dir : dirs) invalidate(dir + "/" + event->name);
+            }
+        }
+    }
+}
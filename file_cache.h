@@ -0,0 +1,111 @@
+#ifndef WEBSERVER_FILE_CACHE_H
+#define WEBSERVER_FILE_CACHE_H
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "locker.h"
+
+/*
+ * class file_cache
+ * Open files under doc_root, shared by all threads: the fd, the stat and, once a response needs
+ * it, a read-only mapping of the whole file, keyed by the path the request resolves to. A hit
+ * costs no syscall at all. The cache is split into shards with a lock and an LRU list each;
+ * entries are reference counted, so one evicted or invalidated while a response still sends
+ * from it is only closed and unmapped when that response is done.
+ * Freshness comes from inotify instead of a stat per request: every directory a cached file is
+ * in is watched, and a change of a name in it drops that name.
+ */
+class file_cache {
+public:
+    static const int SHARDS = 16;
+    static const long DEFAULT_BUDGET = 64L << 20;
+    static const int MAX_ENTRIES = 4096; // open fds at most.
+
+    struct entry {
+        std::string path;
+        int fd;
+        struct stat st;
+        char *address; // mapping of the whole file, nullptr until map().
+        char *data; // a copy of the whole file if it is smaller than the inline size, else nullptr.
+        std::atomic<int> refs; // the cache's own, while it is in the cache, and one per user.
+        bool cached; // in its shard's map and LRU list.
+        entry *prev, *next; // LRU, the most recently used first. next chains evicted entries too.
+    };
+
+    // budget: bytes of mappings, copies and entries kept, the least recently used are dropped
+    // beyond it. Files smaller than inline_size are read into memory when they are opened, so
+    // responses send them without any mapping.
+    explicit file_cache(long budget = DEFAULT_BUDGET, long inline_size = 0);
+    ~file_cache();
+    bool start(); // the inotify thread, false if there is no inotify.
+
+    // the entry of a readable regular file, with a reference for the caller; nullptr if the file
+    // isn't one, can't be opened or its path has "..": the caller finds out why, or serves it
+    // without the cache.
+    entry* acquire(const char *path);
+    void release(entry *e);
+    // the size of a cached file without a reference, opening or counting anything; false on a miss.
+    bool peek(const char *path, off_t &size);
+    // false if a mapping of all of e wouldn't fit its shard's budget, it would be evicted at once.
+    bool mappable(const entry *e) const;
+    // the mapping of e, made on first use. nullptr if mmap fails.
+    char* map(entry *e);
+
+    static void print_stats();
+
+public:
+    static std::atomic<unsigned long> m_hits;
+    static std::atomic<unsigned long> m_misses;
+    static std::atomic<unsigned long> m_evictions;
+    static std::atomic<unsigned long> m_invalidations;
+    static std::atomic<long> m_entries; // in all shards.
+    static std::atomic<long> m_bytes;
+
+private:
+    struct shard {
+        locker m_locker;
+        std::unordered_map<std::string, entry*> m_entries;
+        entry *m_head, *m_tail;
+        long m_bytes;
+        int m_count;
+        // bumped by every invalidation: a file opened before one isn't put into the cache.
+        unsigned long m_generation;
+        shard(): m_locker("file cache"), m_head(nullptr), m_tail(nullptr), m_bytes(0), m_count(0),
+                 m_generation(0) {}
+    };
+
+    // "//" and "/./" collapsed, so a file has one key. false for a path with "..".
+    static bool normalize(const char *path, std::string &key);
+    shard& shard_of(const std::string &key);
+    static long charge(const entry *e); // the bytes e counts against the budget.
+    // out of the LRU list and the map, the caller drops the cache's reference.
+    void unlink(shard &s, entry *e);
+    void push_front(shard &s, entry *e);
+    // unlinks least recently used entries until s fits its part of the budget, chained by next.
+    entry* evict(shard &s);
+    void release_chain(entry *e);
+    static void destroy(entry *e);
+    void invalidate(const std::string &key);
+    void invalidate_all();
+    bool watch(const std::string &key); // the directory of key.
+    static void* worker(void *arg);
+    void run();
+
+private:
+    shard m_shards[SHARDS];
+    long m_shard_budget;
+    long m_inline_size;
+    int m_inotifyfd;
+    pthread_t m_thread;
+    bool m_running;
+    locker m_watch_locker;
+    // inotify watch -> the directory, under every name it was watched by (symbolic links).
+    std::unordered_map<int, std::vector<std::string> > m_watches;
+    std::unordered_map<std::string, int> m_watched;
+};
+
+#endif //WEBSERVER_FILE_CACHE_H
@@ -3,24 +3,46 @@
 //
 
 #include "http_conn.h"
+#include "crlf_scan.h"
 
 #define DEBUG
 
 // 定义HTTP响应的一些状态信息
 const char* ok_200_title = "OK";
+const char* partial_206_title = "Partial Content";
+const char* not_modified_304_title = "Not Modified";
 const char* error_400_title = "Bad Request";
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title = "Forbidden";
 const char* error_403_form = "You do not have permission to get file from this server.\n";
 const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
+const char* error_416_title = "Range Not Satisfiable";
 const char* error_500_title = "Internal Error";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
 
+// sent as is to connections that cannot be served, no formatting on the overload path.
+static const char busy_503_response[] =
+        "HTTP/1.1 503 Service Unavailable\r\n"
+        "Content-Length: 0\r\n"
+        "Retry-After: 1\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+
 const char* doc_root = "/home/sapplehalf/Documents/webserver/resources";
 
 int http_conn::m_epollfd = -1; // all socket events are registed on the same epoll object.
-int http_conn::m_user_count = 0; // # of clients.
+std::atomic<int> http_conn::m_user_count(0); // # of clients.
+std::atomic<unsigned long> http_conn::m_requests(0);
+std::atomic<unsigned long> http_conn::m_reused(0);
+std::atomic<unsigned long> http_conn::m_close_requested(0);
+std::atomic<unsigned long> http_conn::m_not_modified(0);
+std::atomic<unsigned long> http_conn::m_partial(0);
+long http_conn::m_sendfile_threshold = http_conn::DEFAULT_SENDFILE_THRESHOLD;
+long http_conn::m_inline_threshold = http_conn::DEFAULT_INLINE_THRESHOLD;
+file_cache *http_conn::m_file_cache = nullptr;
+// multipart boundaries, a new one per response.
+static std::atomic<unsigned long> boundary_seq(0);
 
 void setnonblocking(int fd){
     int old_flag = fcntl(fd, F_GETFL);
@@ -42,8 +64,9 @@ void addfd(int epollfd, int fd, bool one_shot){
 
 // remove listened fd from epoll
 int removefd(int epollfd, int fd){
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
+    int ret = epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
     close(fd);
+    return ret;
 }
 
 //modify fd, reset oneshot event to make sure that EPOLLIN
@@ -55,22 +78,54 @@ void modfd(int epollfd, int fd, int ev){
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
-void http_conn::init(int sockfd, const sockaddr_in &addr){
+void http_conn::init(int sockfd, const sockaddr_in &addr, int epollfd){
     m_sockfd = sockfd;
     m_address = addr;
+    m_conn_epollfd = epollfd;
+    m_file_address = nullptr;
+    m_file_size = 0;
+    m_file_fd = -1;
+    m_cache_entry = nullptr;
+    m_read_body = false;
+    m_last_worker = -1;
+    m_priority = PRIORITY_HIGH;
+    m_served = 0;
+    m_corked = false;
 
     // port multiplexing
     int reuse = 1;
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
-    // add to EPOLL.
-    addfd(m_epollfd, m_sockfd, true);
     m_user_count++;
     init();
+    // add to EPOLL, unless the connection is driven by a completion based loop.
+    // Last, another thread may pick the socket up as soon as it is registered.
+    if (m_conn_epollfd >= 0) addfd(m_conn_epollfd, m_sockfd, true);
+}
+
+void http_conn::send_busy(int sockfd){
+    // best effort, the socket buffer always has room for it unless a response is stuck in it.
+    send(sockfd, busy_503_response, sizeof busy_503_response - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+
+void http_conn::print_stats(){
+    unsigned long requests = m_requests.load(), reused = m_reused.load();
+    printf("http: requests %lu, on reused connections %lu (%.1f%%), closed on request %lu, not modified %lu, "
+           "partial %lu.\n", requests, reused, requests ? 100.0 * reused / requests : 0.0,
+           m_close_requested.load(), m_not_modified.load(), m_partial.load());
+}
+
+void http_conn::reject(){
+    if (m_sockfd != -1) {
+        send_busy(m_sockfd);
+        close_conn();
+    }
 }
 
 void http_conn::close_conn(){
     if (m_sockfd != -1) {
-        removefd(m_epollfd, m_sockfd);
+        unmap(); // a response may be abandoned half sent.
+        if (m_conn_epollfd >= 0) removefd(m_conn_epollfd, m_sockfd);
+        else close(m_sockfd);
         m_sockfd = -1;
         m_user_count--;
     }
@@ -79,7 +134,9 @@ void http_conn::close_conn(){
 bool http_conn::read(){
     if (m_read_idx > READ_BUFFER_SIZE) return false; // current pointer position is after the end of buffer.
     int bytes_read = 0; // read bytes
-    while(true){
+    // a full buffer is left to prepare_response(): what it answers makes room, and the loop is
+    // told about the rest of the data when the fd is armed for EPOLLIN again.
+    while(m_read_idx < READ_BUFFER_SIZE){
         bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0 ); // P81
         if (bytes_read == -1){ // error
             if (errno == EAGAIN || errno == EWOULDBLOCK) break; // no data
@@ -93,51 +150,145 @@ bool http_conn::read(){
     return true;
 }
 
+void http_conn::classify(){
+    m_priority = PRIORITY_HIGH;
+    if (m_check_state == CHECK_STATE_CONTENT && m_content_length > 0) {
+        m_priority = PRIORITY_LOW; // the rest of a body.
+        return;
+    }
+    // a pipelined batch goes by its first request.
+    char path[FILENAME_LEN];
+    int len = strlen(doc_root);
+    if (m_check_state == CHECK_STATE_REQUESTLINE) {
+        // "GET /index.html HTTP/1.1", not split by the parser yet. Anything else is cheap to answer.
+        const char *line = m_read_buf + m_start_line;
+        const char *eol = (const char*) memchr(line, '\n', m_read_buf + m_read_idx - line);
+        if (!eol) return;
+        const char *url = (const char*) memchr(line, ' ', eol - line);
+        if (!url || *++url != '/') return;
+        const char *url_end = (const char*) memchr(url, ' ', eol - url);
+        if (!url_end || url_end - url >= FILENAME_LEN - len) return;
+        memcpy(path, doc_root, len);
+        memcpy(path + len, url, url_end - url);
+        path[len + (url_end - url)] = '\0';
+    } else {
+        // the request line is parsed, the headers are not complete yet.
+        if (!m_url) return;
+        snprintf(path, sizeof path, "%s%s", doc_root, m_url);
+    }
+    off_t size;
+    if (!m_file_cache || !m_file_cache->peek(path, size)) {
+        struct stat st;
+        if (stat(path, &st) < 0) return;
+        size = st.st_size;
+    }
+    if (size >= LARGE_FILE_SIZE) m_priority = PRIORITY_LOW;
+}
+
 bool http_conn::write(){
     int temp = 0;
     if ( bytes_to_send == 0 ) {
         // 将要发送的字节为0，这一次响应结束。
-        modfd( m_epollfd, m_sockfd, EPOLLIN );
-        init();
+        init_response();
+        modfd( m_conn_epollfd, m_sockfd, EPOLLIN );
         return true;
     }
 
     while(true) {
-        temp = writev(m_sockfd, m_iv, m_iv_count); // read or write data into multiple buffers
+        // all queued responses at once, up to the next body sent with sendfile.
+        temp = send_iov();
         if (temp <= -1) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if (errno == EAGAIN) {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                modfd(m_conn_epollfd, m_sockfd, EPOLLOUT);
                 return true;
             }
             unmap();
             return false;
         }
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if (bytes_have_send >= m_iv[0].iov_len){
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
+        int ret = on_write(temp);
+        if (ret > 0) continue;
+        if (m_corked) {
+            // the batch is out, let the last segment go.
+            int off = 0;
+            setsockopt(m_sockfd, IPPROTO_TCP, TCP_CORK, &off, sizeof off);
+            m_corked = false;
         }
-        else {
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - temp;
+        if (ret == 0) {
+            // more pipelined requests than one batch takes may be waiting in m_read_buf.
+            ret = prepare_response();
+            if (ret > 0) continue;
         }
-        if (!bytes_to_send) {
-            unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
 
-            if (m_linger) {
-                init();
-                return true;
-            }
-            else return false;
+        modfd(m_conn_epollfd, m_sockfd, EPOLLIN);
+        return ret == 0;
+    }
+
+}
+
+int http_conn::fill_read(const char *data, int len) {
+    if (len > READ_BUFFER_SIZE - m_read_idx) len = READ_BUFFER_SIZE - m_read_idx;
+    memcpy(m_read_buf + m_read_idx, data, len);
+    m_read_idx += len;
+    return len;
+}
+
+// writev the iovecs up to the next file part, or sendfile that part. Text followed by a file part
+// goes with MSG_MORE, so a head doesn't leave in a segment of its own. sendfile takes no flags: if
+// more follows a file part, the socket is corked until the batch is out, or every small body
+// would leave as a segment of its own and wait for an ACK (Nagle).
+ssize_t http_conn::send_iov() {
+    if (!m_iv[m_iv_index].iov_base) {
+        if (!m_corked && m_iv_index < m_iv_count - 1) {
+            int on = 1;
+            setsockopt(m_sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof on);
+            m_corked = true;
+        }
+        off_t offset = m_iv_file[m_iv_index].offset;
+        ssize_t ret = sendfile(m_sockfd, m_iv_file[m_iv_index].fd, &offset, m_iv[m_iv_index].iov_len);
+        if (ret == 0) {
+            errno = EIO; // the file got shorter since the stat.
+            return -1;
         }
+        return ret;
+    }
+    int end = m_iv_index;
+    while(end < m_iv_count && m_iv[end].iov_base) end++;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof msg);
+    msg.msg_iov = m_iv + m_iv_index;
+    msg.msg_iovlen = end - m_iv_index;
+    return sendmsg(m_sockfd, &msg, end < m_iv_count ? MSG_MORE : 0);
+}
 
+int http_conn::write_iov(struct iovec **iv) {
+    *iv = m_iv + m_iv_index;
+    return m_iv_count - m_iv_index;
+}
+
+// account for `bytes` sent from m_iv, unmap the files and reset for the next requests once all is sent.
+// The connection stays open if the last response says so.
+int http_conn::on_write(int bytes) {
+    bytes_to_send -= bytes;
+    while(bytes > 0 && m_iv_index < m_iv_count) {
+        struct iovec &iv = m_iv[m_iv_index];
+        if ((size_t) bytes < iv.iov_len) {
+            if (iv.iov_base) iv.iov_base = (char*) iv.iov_base + bytes;
+            else m_iv_file[m_iv_index].offset += bytes;
+            iv.iov_len -= bytes;
+            break;
+        }
+        bytes -= (int) iv.iov_len;
+        iv.iov_len = 0;
+        m_iv_index++;
     }
+    if (bytes_to_send > 0) return 1;
 
+    bool keep_alive = m_response_count > 0 && m_responses[m_response_count - 1].keep_alive;
+    unmap();
+    init_response();
+    return keep_alive ? 0 : -1;
 }
 
 // used by working thread in the thread pool.
@@ -200,11 +351,13 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
         m_method = GET;
     } else return BAD_REQUEST; // grammar error
 
-    // "HTTP/1.1"
+    // "HTTP/1.1", or "HTTP/1.0". 1.1 connections persist unless the client says otherwise.
     m_version = strpbrk(m_url, " \t");
     if (!m_version) return BAD_REQUEST;
     *m_version++ = '\0';
-    if (strcasecmp(m_version, "HTTP/1.1") != 0) return BAD_REQUEST;
+    if (strcasecmp(m_version, "HTTP/1.1") == 0) m_linger = true;
+    else if (strcasecmp(m_version, "HTTP/1.0") == 0) m_linger = false;
+    else return BAD_REQUEST;
 
     // "http://192.168.110.129:10000/index.html"
     if (strncasecmp(m_url, "http://", 7) == 0) {
@@ -227,6 +380,18 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text){
 }
 
 // 解析HTTP请求的一个头部信息
+// true if the comma separated list value has token, case insensitive.
+static bool has_token(const char *value, const char *token){
+    size_t length = strlen(token);
+    while(*value) {
+        value += strspn(value, " \t,");
+        size_t n = strcspn(value, " \t,");
+        if (n == length && strncasecmp(value, token, length) == 0) return true;
+        value += n;
+    }
+    return false;
+}
+
 http_conn::HTTP_CODE http_conn::parse_headers(char* text){
     if ( text[0] == '\0') {
         if (m_content_length != 0) {
@@ -244,31 +409,45 @@ printf("m_content_length != 0");
 #endif
         return GET_REQUEST; // get a complete HTTP request.
 
-    } else if (strncasecmp(text, "Connection:", 11) == 0) {
-        // Head part of connection. "Connection: keep-alive"
-        text += 11;
-        text += strspn(text, " \t");
-        if (strcasecmp(text, "keep-alive") == 0) m_linger = true;
-    } else if (strncasecmp(text, "Content-Length:", 15) == 0) {
-        // Content-Length part
-        text += 15;
-        text += strspn(text, " \t");
-        m_content_length = atol(text);
-    } else if (strncasecmp(text, "Host:", 5) == 0) {
-        // Host part
-        text += 5;
-        text += strspn(text, " \t");
-        m_host = text;
-    } else {
+    }
+
+    // "Name: value". Known names are indexed, the value stays where it is in m_read_buf.
+    char *colon = strchr(text, ':');
+    http_header::ID id = colon ? http_header::lookup(text, (int) (colon - text)) : http_header::UNKNOWN;
+    if (id == http_header::UNKNOWN) {
         printf("Error: Unknown header %s.\n", text);
+        return NO_REQUEST;
+    }
+    char *value = colon + 1;
+    value += strspn(value, " \t");
+    int length = (int) strlen(value);
+    while(length > 0 && (value[length - 1] == ' ' || value[length - 1] == '\t')) value[--length] = '\0';
+    if (m_headers[id].length < 0) {
+        m_headers[id].offset = (int) (value - m_read_buf);
+        m_headers[id].length = length;
+    }
+
+    switch(id) {
+        case http_header::CONNECTION: // "Connection: keep-alive" or "close", maybe among other options.
+            if (has_token(value, "close")) m_linger = false;
+            else if (has_token(value, "keep-alive")) m_linger = true;
+            break;
+        case http_header::CONTENT_LENGTH:
+            m_content_length = atol(value);
+            break;
+        case http_header::HOST:
+            m_host = value;
+            break;
+        default:
+            break;
     }
     return NO_REQUEST;
 }
 
 // 判断HTTP请求的消息体是否被完整的读入了
-http_conn::HTTP_CODE http_conn::parse_content(char* text){
+http_conn::HTTP_CODE http_conn::parse_content(char*){
     if (m_read_idx >= m_content_length + m_checked_idx) {
-        text[m_content_length] = '\0';
+        // not terminated in place: the next pipelined request may start right after the body.
 #ifdef DEBUG
         printf("GET_REQUEST");
 #endif
@@ -283,7 +462,9 @@ http_conn::HTTP_CODE http_conn::parse_content(char* text){
 // 解析一行，判断依据\r\n
 http_conn::LINE_STATUS http_conn::parse_line() {
     char temp;
-    for(;  m_checked_idx < m_read_idx; ++m_checked_idx) {
+    // skip to the next '\r' or '\n' many bytes at a time, see crlf_scan.h.
+    m_checked_idx = find_line_end(m_read_buf + m_checked_idx, m_read_buf + m_read_idx) - m_read_buf;
+    if (m_checked_idx < m_read_idx) {
         temp = m_read_buf[m_checked_idx];
         if (temp == '\r') {
             if (m_checked_idx + 1 == m_read_idx) return LINE_OPEN; // incomplete line
@@ -305,28 +486,80 @@ http_conn::LINE_STATUS http_conn::parse_line() {
 }
 
 // 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
-void http_conn::process(){
-    // parse HTTP requests.
-    HTTP_CODE read_ret = process_read();
+bool http_conn::process(){
+    int ret = prepare_response();
+    if (ret == 0) {
+        modfd(m_conn_epollfd, m_sockfd, EPOLLIN);
+        return true;
+    }
+    if (ret < 0) {
+        close_conn();
+        return false;
+    }
+    modfd(m_conn_epollfd, m_sockfd, EPOLLOUT);
+    return true;
+}
+
+// answer every complete request in m_read_buf (pipelining), up to MAX_PIPELINE of them; their
+// responses are queued in order and sent together.
+int http_conn::prepare_response(){
+    while(m_response_count < MAX_PIPELINE && m_slice_count + MAX_RANGES <= MAX_SLICES
+          && m_write_idx <= WRITE_BUFFER_SIZE - RESPONSE_HEAD_SIZE) {
+        // parse HTTP requests.
+        HTTP_CODE read_ret = process_read();
 #ifdef DEBUG
-    printf("Finish Reading.\n");
+        printf("Finish Reading.\n");
 #endif
-    if (read_ret == NO_REQUEST) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        if (read_ret == NO_REQUEST) {
 #ifdef DEBUG
-        printf("NO_REQUEST.\n");
+            printf("NO_REQUEST.\n");
 #endif
-        return;
-    }
+            break;
+        }
+
+        // a large file may page fault all the way through the mmap, a body has to be received.
+        if (m_response_count == 0) m_priority = PRIORITY_HIGH;
+        if (m_file_size >= LARGE_FILE_SIZE || m_content_length > 0) {
+            m_priority = PRIORITY_LOW;
+        }
 
-    // create responses.
-    bool write_ret = process_write(read_ret);
-    if (!write_ret) close_conn();
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+        // the next request starts after the body, if there is one.
+        int end = m_check_state == CHECK_STATE_CONTENT ? m_checked_idx + m_content_length : m_checked_idx;
+        // where a malformed request ends is unknown, answer it and close.
+        if (read_ret == BAD_REQUEST || read_ret == INTERNAL_ERROR) m_linger = false;
 
-};
+        m_requests.fetch_add(1, std::memory_order_relaxed);
+        if (m_served++ > 0) m_reused.fetch_add(1, std::memory_order_relaxed);
+        if (!m_linger && read_ret != BAD_REQUEST && read_ret != INTERNAL_ERROR) {
+            m_close_requested.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // create responses.
+        if (!process_write(read_ret)) return -1;
+        bool keep_alive = m_linger;
+        consume_request(end);
+        if (!keep_alive) break; // requests after a "Connection: close" are not answered.
+    }
+    // a request head that doesn't fit the buffer is never answered.
+    if (m_response_count == 0) return m_read_idx < READ_BUFFER_SIZE ? 0 : -1;
+    build_iov();
+    return 1;
+}
 
 void http_conn::init(){
+    init_request();
+    init_response();
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_read_idx = 0;
+
+    bzero(m_read_buf, READ_BUFFER_SIZE);
+    bzero(m_write_buf, WRITE_BUFFER_SIZE);
+    bzero(m_real_file, FILENAME_LEN);
+
+}
+
+void http_conn::init_request(){
     m_check_state = CHECK_STATE_REQUESTLINE; //initialize the state at the first line.
 
     m_method = GET; // 默认请求方式为GET
@@ -334,16 +567,70 @@ void http_conn::init(){
     m_version = nullptr;
     m_content_length = 0;
     m_host = nullptr;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
+    for(auto &header : m_headers) header.length = -1;
     m_linger = false; // 默认不保持链接  Connection : keep-alive保持连接
+}
 
-    bzero(m_read_buf, READ_BUFFER_SIZE);
-    bzero(m_write_buf, WRITE_BUFFER_SIZE);
-    bzero(m_real_file, FILENAME_LEN);
+void http_conn::init_response(){
+    m_write_idx = 0;
+    m_response_count = 0;
+    m_slice_count = 0;
+    m_iv_count = 0;
+    m_iv_index = 0;
+    bytes_to_send = 0;
+}
 
+// the request in [0, end) is answered: move what was read after it to the front.
+void http_conn::consume_request(int end){
+    int rest = m_read_idx - end;
+    memmove(m_read_buf, m_read_buf + end, rest);
+    bzero(m_read_buf + rest, end);
+    m_read_idx = rest;
+    m_checked_idx = 0;
+    m_start_line = 0;
+    init_request();
+}
+
+// one iovec per run of text in m_write_buf and one per file slice.
+void http_conn::build_iov(){
+    m_iv_count = 0;
+    m_iv_index = 0;
+    bytes_to_send = 0;
+    int text_start = 0;
+    int s = 0;
+    for(int i = 0; i < m_response_count; i++) {
+        const response &r = m_responses[i];
+        for(; s < r.slice_end; s++) {
+            add_iov(m_write_buf + text_start, m_slices[s].text_end - text_start);
+            text_start = m_slices[s].text_end;
+            if (r.file_fd >= 0) add_file_iov(r.file_fd, m_slices[s].offset, m_slices[s].length);
+            else add_iov(r.file_address + m_slices[s].offset, m_slices[s].length);
+        }
+        add_iov(m_write_buf + text_start, r.head_end - text_start);
+        text_start = r.head_end;
+    }
+}
+
+void http_conn::add_iov(char *base, size_t length){
+    if (length == 0) return;
+    bytes_to_send += length;
+    if (m_iv_count > 0 && m_iv[m_iv_count - 1].iov_base
+        && (char*) m_iv[m_iv_count - 1].iov_base + m_iv[m_iv_count - 1].iov_len == base) {
+        m_iv[m_iv_count - 1].iov_len += length;
+        return;
+    }
+    m_iv[m_iv_count].iov_base = base;
+    m_iv[m_iv_count].iov_len = length;
+    m_iv_count++;
+}
+
+void http_conn::add_file_iov(int fd, off_t offset, off_t length){
+    bytes_to_send += length;
+    m_iv[m_iv_count].iov_base = nullptr;
+    m_iv[m_iv_count].iov_len = length;
+    m_iv_file[m_iv_count].fd = fd;
+    m_iv_file[m_iv_count].offset = offset;
+    m_iv_count++;
 }
 
 // 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
@@ -358,26 +645,248 @@ http_conn::HTTP_CODE http_conn::do_request(){
     printf("%s", m_real_file);
 #endif
 
-    // 获取m_real_file文件的相关的状态信息，-1失败，0成功
-    if (stat(m_real_file, &m_file_stat) < 0) return NO_RESOURCE; // 0 is success.
-    if (!(m_file_stat.st_mode & S_IROTH)) return FORBIDDEN_REQUEST; // forbidden access
-    if (S_ISDIR(m_file_stat.st_mode)) return BAD_REQUEST; //if is directory.
-    int fd = open(m_real_file, O_RDONLY); // read only
+    // a cached file takes no syscall. Anything else is looked at the slow way, which also finds
+    // out why the cache didn't take it.
+    m_cache_entry = m_file_cache ? m_file_cache->acquire(m_real_file) : nullptr;
+    if (m_cache_entry) {
+        m_file_stat = m_cache_entry->st;
+    } else {
+        // 获取m_real_file文件的相关的状态信息，-1失败，0成功
+        if (stat(m_real_file, &m_file_stat) < 0) return NO_RESOURCE; // 0 is success.
+        if (!(m_file_stat.st_mode & S_IROTH)) return FORBIDDEN_REQUEST; // forbidden access
+        if (S_ISDIR(m_file_stat.st_mode)) return BAD_REQUEST; //if is directory.
+    }
+    // revalidation: no open and no mmap if the client's copy is current.
+    if (not_modified()) {
+        m_not_modified.fetch_add(1, std::memory_order_relaxed);
+        close_file();
+        return NOT_MODIFIED;
+    }
+    HTTP_CODE ret = parse_range();
+    if (ret == RANGE_NOT_SATISFIABLE) {
+        close_file();
+        return ret;
+    }
+
+    // map only the part that is sent, a seek into a large file doesn't keep all of it mapped.
+    off_t first = 0, last = m_file_stat.st_size - 1;
+    off_t body = m_file_stat.st_size; // bytes of the file that are sent, ranges may overlap.
+    if (ret == PARTIAL_CONTENT) {
+        m_partial.fetch_add(1, std::memory_order_relaxed);
+        first = m_ranges[0].first;
+        last = m_ranges[0].last;
+        body = 0;
+        for(int i = 0; i < m_range_count; i++) {
+            if (m_ranges[i].first < first) first = m_ranges[i].first;
+            if (m_ranges[i].last > last) last = m_ranges[i].last;
+            body += m_ranges[i].last + 1 - m_ranges[i].first;
+        }
+    }
+    bool use_sendfile = m_sendfile_threshold >= 0 && last + 1 - first >= m_sendfile_threshold;
+    int fd = -1;
+    if (m_cache_entry) {
+        // the entry's copy of a small file, its fd, or its mapping of the whole file.
+        m_map_offset = 0;
+        m_file_size = last + 1;
+        if (m_file_size <= 0) {
+            close_file();
+            return ret;
+        }
+        if (m_cache_entry->data) {
+            m_file_address = m_cache_entry->data;
+            return ret;
+        }
+        if (use_sendfile) {
+            m_file_fd = m_cache_entry->fd;
+            return ret;
+        }
+        if (m_file_cache->mappable(m_cache_entry)) {
+            m_file_address = m_file_cache->map(m_cache_entry);
+            if (!m_file_address) {
+                close_file();
+                return INTERNAL_ERROR;
+            }
+            return ret;
+        }
+        // too large to keep mapped: the part that is sent is mapped for this response only.
+        fd = dup(m_cache_entry->fd);
+        close_file();
+        if (fd < 0) return INTERNAL_ERROR;
+    }
+    m_map_offset = first & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+    m_file_size = last + 1 - m_map_offset;
+    if (m_file_size <= 0) {
+        m_file_size = 0; // an empty file, nothing to map.
+        return ret;
+    }
+    if (fd < 0) fd = open(m_real_file, O_RDONLY); // read only
 #ifdef DEBUG
     printf("fd: %d.\n", fd);
 #endif
+    if (fd < 0) {
+        m_file_size = 0;
+        return INTERNAL_ERROR;
+    }
+    // a small body is read right behind its head into m_write_buf, see add_slice(): no mapping,
+    // and head and body leave as one piece of text. Every range is read, with its part head.
+    off_t text = body + (ret == PARTIAL_CONTENT && m_range_count > 1 ? m_range_count * PART_HEAD_SIZE : 0);
+    if (body < m_inline_threshold && text <= WRITE_BUFFER_SIZE - RESPONSE_HEAD_SIZE - m_write_idx) {
+        m_file_fd = fd;
+        m_map_offset = 0;
+        m_read_body = true;
+        return ret;
+    }
+    // a large body goes from the page cache to the socket with sendfile: no page faults, and no
+    // munmap whose TLB shootdown interrupts every worker thread.
+    if (use_sendfile) {
+        m_file_fd = fd;
+        m_map_offset = 0;
+        return ret;
+    }
     // create a memory mapping
-    m_file_address = (char*) mmap(nullptr, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    m_file_address = (char*) mmap(nullptr, m_file_size, PROT_READ, MAP_PRIVATE, fd, m_map_offset);
     close(fd);
-    return FILE_REQUEST;
+    if (m_file_address == MAP_FAILED) {
+        m_file_address = nullptr;
+        m_file_size = 0;
+        return INTERNAL_ERROR;
+    }
+    return ret;
+}
+
+// the Range header against the file in m_file_stat: FILE_REQUEST for the whole file (no Range, one
+// that doesn't parse, too many ranges, or If-Range names another version of the file),
+// PARTIAL_CONTENT with m_ranges set, RANGE_NOT_SATISFIABLE if no range overlaps the file.
+http_conn::HTTP_CODE http_conn::parse_range(){
+    m_range_count = 0;
+    const char *p = header(http_header::RANGE);
+    if (!p || strncasecmp(p, "bytes=", 6) != 0 || !range_current()) return FILE_REQUEST;
+    p += 6;
+    off_t size = m_file_stat.st_size;
+    int specs = 0;
+    while(true) {
+        p += strspn(p, " \t,");
+        if (*p == '\0') break;
+        off_t first, last;
+        char *end;
+        if (*p == '-') {
+            // "-n": the last n bytes.
+            if (!isdigit((unsigned char) p[1])) return FILE_REQUEST;
+            off_t n = strtoll(p + 1, &end, 10);
+            first = n >= size ? 0 : size - n;
+            last = n == 0 ? -1 : size - 1;
+        } else {
+            // "first-last" or "first-".
+            if (!isdigit((unsigned char) *p)) return FILE_REQUEST;
+            first = strtoll(p, &end, 10);
+            if (*end++ != '-') return FILE_REQUEST;
+            if (isdigit((unsigned char) *end)) {
+                last = strtoll(end, &end, 10);
+                if (last < first) return FILE_REQUEST;
+            } else {
+                last = size - 1;
+            }
+            if (last >= size) last = size - 1;
+        }
+        p = end + strspn(end, " \t");
+        if (*p != '\0' && *p != ',') return FILE_REQUEST;
+        specs++;
+        if (first > last) continue; // outside of the file, the others may not be.
+        if (m_range_count == MAX_RANGES) return FILE_REQUEST;
+        m_ranges[m_range_count].first = first;
+        m_ranges[m_range_count].last = last;
+        m_range_count++;
+    }
+    if (specs == 0) return FILE_REQUEST;
+    return m_range_count > 0 ? PARTIAL_CONTENT : RANGE_NOT_SATISFIABLE;
+}
+
+// strong ETag "inode-size-mtime": any change of the file changes one of them.
+int http_conn::format_etag(char *buf, int size) const {
+    return snprintf(buf, size, "\"%lx-%lx-%lx.%lx\"", (unsigned long) m_file_stat.st_ino,
+                    (unsigned long) m_file_stat.st_size, (unsigned long) m_file_stat.st_mtim.tv_sec,
+                    (unsigned long) m_file_stat.st_mtim.tv_nsec);
+}
+
+// true if value, an If-None-Match list, has etag or "*". Weak comparison: W/ doesn't matter.
+static bool etag_matches(const char *value, const char *etag){
+    size_t length = strlen(etag);
+    while(*value) {
+        value += strspn(value, " \t,");
+        if (*value == '*') return true;
+        if (strncmp(value, "W/", 2) == 0) value += 2;
+        size_t n = strcspn(value, " \t,");
+        if (n == length && strncmp(value, etag, length) == 0) return true;
+        value += n;
+    }
+    return false;
+}
+
+// "Sun, 06 Nov 1994 08:49:37 GMT", the only date format sent nowadays.
+static bool parse_http_date(const char *value, time_t *date){
+    struct tm tm;
+    memset(&tm, 0, sizeof tm);
+    const char *end = strptime(value, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0') return false;
+    *date = timegm(&tm);
+    return true;
+}
+
+bool http_conn::not_modified() const {
+    const char *if_none_match = header(http_header::IF_NONE_MATCH);
+    if (if_none_match) {
+        // takes precedence, If-Modified-Since is ignored then.
+        char etag[64];
+        format_etag(etag, sizeof etag);
+        return etag_matches(if_none_match, etag);
+    }
+    const char *if_modified_since = header(http_header::IF_MODIFIED_SINCE);
+    time_t date;
+    return if_modified_since && parse_http_date(if_modified_since, &date) && m_file_stat.st_mtime <= date;
+}
+
+bool http_conn::range_current() const {
+    const char *if_range = header(http_header::IF_RANGE);
+    if (!if_range) return true;
+    if (if_range[0] == '"' || strncmp(if_range, "W/", 2) == 0) {
+        // strong comparison, a weak tag never matches.
+        char etag[64];
+        format_etag(etag, sizeof etag);
+        return strcmp(if_range, etag) == 0;
+    }
+    time_t date;
+    return parse_http_date(if_range, &date) && date == m_file_stat.st_mtime;
 }
 
 // 对内存映射区执行munmap操作
 void http_conn::unmap() {
-    if (m_file_address) {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = nullptr;
+    close_file();
+    for(int i = 0; i < m_response_count; i++) {
+        response &r = m_responses[i];
+        if (r.cache_entry) {
+            m_file_cache->release(r.cache_entry);
+            r.cache_entry = nullptr;
+        } else {
+            if (r.file_address) munmap(r.file_address, r.file_size);
+            if (r.file_fd >= 0) close(r.file_fd);
+        }
+        r.file_address = nullptr;
+        r.file_fd = -1;
+    }
+}
+
+void http_conn::close_file() {
+    if (m_cache_entry) {
+        m_file_cache->release(m_cache_entry);
+        m_cache_entry = nullptr;
+    } else {
+        if (m_file_address) munmap(m_file_address, m_file_size);
+        if (m_file_fd >= 0) close(m_file_fd);
     }
+    m_file_address = nullptr;
+    m_file_fd = -1;
+    m_file_size = 0;
+    m_read_body = false;
 }
 
 bool http_conn::process_write(HTTP_CODE ret) {
@@ -415,26 +924,109 @@ bool http_conn::process_write(HTTP_CODE ret) {
     printf("FILE_REQUEST.\n");
 #endif
             add_status_line(200, ok_200_title );
+            add_validators();
+            add_response("Accept-Ranges: bytes\r\n");
             add_headers(m_file_stat.st_size);
-            m_iv[0].iov_base = m_write_buf;
-            m_iv[0].iov_len = m_write_idx;
-            m_iv[1].iov_base = m_file_address;
-            m_iv[1].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            bytes_to_send = m_write_idx + m_file_stat.st_size;
+            if (m_file_size > 0 && !add_slice(byte_range{0, m_file_stat.st_size - 1})) return false;
 #ifdef DEBUG
             printf("FILE_REQUEST: true.\n");
 #endif
-            return true;
+            break;
+        case PARTIAL_CONTENT:
+            add_status_line(206, partial_206_title);
+            add_validators();
+            if (m_range_count == 1) {
+                const byte_range &range = m_ranges[0];
+                add_response("Content-Range: bytes %ld-%ld/%ld\r\n", (long) range.first, (long) range.last,
+                             (long) m_file_stat.st_size);
+                add_headers(range.last + 1 - range.first);
+                if (!add_slice(range)) return false;
+            } else if (!add_multipart()) {
+                return false;
+            }
+            break;
+        case RANGE_NOT_SATISFIABLE:
+            add_status_line(416, error_416_title);
+            add_response("Content-Range: bytes */%ld\r\n", (long) m_file_stat.st_size);
+            add_headers(0);
+            break;
+        case NOT_MODIFIED:
+            // the validators again and no body.
+            add_status_line(304, not_modified_304_title);
+            add_validators();
+            add_linger();
+            add_blank_line();
+            break;
         default:
             return false;
     }
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
+    if (m_read_body) close_file(); // the body is in the text already.
+    // queue the response, the file mapping goes with it.
+    response &r = m_responses[m_response_count++];
+    r.head_end = m_write_idx;
+    r.file_address = m_file_address;
+    r.file_size = m_file_size;
+    r.file_fd = m_file_fd;
+    r.cache_entry = m_cache_entry;
+    r.slice_end = m_slice_count;
+    r.keep_alive = m_linger;
+    m_file_address = nullptr;
+    m_file_size = 0;
+    m_file_fd = -1;
+    m_cache_entry = nullptr;
+    return true;
+}
+
+bool http_conn::add_slice(const byte_range &range){
+    off_t length = range.last + 1 - range.first;
+    if (m_read_body) {
+        // into the text, it takes no slice.
+        if (length > WRITE_BUFFER_SIZE - 1 - m_write_idx) return false;
+        off_t done = 0;
+        while(done < length) {
+            ssize_t n = pread(m_file_fd, m_write_buf + m_write_idx + done, length - done, range.first + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false; // the file got shorter since the stat.
+            done += n;
+        }
+        m_write_idx += (int) length;
+        return true;
+    }
+    slice &s = m_slices[m_slice_count++];
+    s.text_end = m_write_idx;
+    s.offset = range.first - m_map_offset;
+    s.length = length;
     return true;
 }
 
+static const char part_head_format[] = "\r\n--%s\r\nContent-Type: text/html\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n";
+static const char closing_boundary_format[] = "\r\n--%s--\r\n";
+
+bool http_conn::add_multipart(){
+    char boundary[32];
+    snprintf(boundary, sizeof boundary, "%020lu", boundary_seq.fetch_add(1, std::memory_order_relaxed));
+    // the part heads are formatted once only to count them into Content-Length.
+    long length = snprintf(nullptr, 0, closing_boundary_format, boundary);
+    for(int i = 0; i < m_range_count; i++) {
+        const byte_range &range = m_ranges[i];
+        length += snprintf(nullptr, 0, part_head_format, boundary, (long) range.first, (long) range.last,
+                           (long) m_file_stat.st_size);
+        length += range.last + 1 - range.first;
+    }
+    add_content_length(length);
+    add_response("Content-Type: multipart/byteranges; boundary=%s\r\n", boundary);
+    add_linger();
+    add_blank_line();
+    for(int i = 0; i < m_range_count; i++) {
+        const byte_range &range = m_ranges[i];
+        if (!add_response(part_head_format, boundary, (long) range.first, (long) range.last,
+                          (long) m_file_stat.st_size) || !add_slice(range)) {
+            return false;
+        }
+    }
+    return add_response(closing_boundary_format, boundary);
+}
+
 // 往写缓冲中写入待发送的数据
 bool http_conn::add_response(const char* format, ...){
     // va_list: https://blog.csdn.net/mediatec/article/details/94637013
@@ -442,8 +1034,8 @@ bool http_conn::add_response(const char* format, ...){
     va_list arg_list;
     va_start(arg_list, format);
     int len = vsnprintf(m_write_buf + m_write_idx,
-                        WRITE_BUFFER_SIZE - 1 - m_checked_idx, format, arg_list);
-    if (len >= (WRITE_BUFFER_SIZE - 1 - m_checked_idx)) return false;
+                        WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
+    if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) return false;
     m_write_idx += len;
     va_end(arg_list);
     return true;
@@ -453,15 +1045,12 @@ bool http_conn::add_status_line(int status, const char* title) {
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
-bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+bool http_conn::add_headers(long content_len) {
+    return add_content_length(content_len) && add_content_type() && add_linger() && add_blank_line();
 }
 
-bool http_conn::add_content_length(int content_len) {
-    return add_response( "Content-Length: %d\r\n", content_len );
+bool http_conn::add_content_length(long content_len) {
+    return add_response( "Content-Length: %ld\r\n", content_len );
 }
 
 bool http_conn::add_linger()
@@ -469,6 +1058,16 @@ bool http_conn::add_linger()
     return add_response("Connection: %s\r\n", m_linger ? "keep-alive" : "close" );
 }
 
+bool http_conn::add_validators() {
+    char etag[64];
+    format_etag(etag, sizeof etag);
+    char date[64];
+    struct tm tm;
+    gmtime_r(&m_file_stat.st_mtime, &tm);
+    strftime(date, sizeof date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return add_response("ETag: %s\r\nLast-Modified: %s\r\n", etag, date);
+}
+
 bool http_conn::add_blank_line()
 {
     return add_response( "%s", "\r\n" );
@@ -6,17 +6,25 @@
 #define WEBSERVER_HTTP_CONN_H
 
 #include <sys/epoll.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <fcntl.h>
 #include <cstdio>
 #include <cerrno>
 #include <string.h>
 #include <cstdlib>
+#include <cctype>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <cstdarg>
+#include <ctime>
 #include <sys/uio.h>
+#include <atomic>
+#include "http_header.h"
+#include "file_cache.h"
 
 
 
@@ -25,6 +33,14 @@ public:
     static const int READ_BUFFER_SIZE = 16384;
     static const int WRITE_BUFFER_SIZE = 16384;
     static const int FILENAME_LEN = 400;
+    // pipelining: responses answered with one writev at most, and the room one needs in m_write_buf.
+    static const int MAX_PIPELINE = 16;
+    static const int RESPONSE_HEAD_SIZE = 2048;
+    // byte ranges: at most MAX_RANGES per request (more get the whole file), and the file slices
+    // one batch of responses may have.
+    static const int MAX_RANGES = 8;
+    static const int PART_HEAD_SIZE = 160; // of a multipart/byteranges part, at most.
+    static const int MAX_SLICES = 2 * MAX_PIPELINE;
 
 
     // HTTP请求方法，这里只支持GET
@@ -48,26 +64,91 @@ public:
         FILE_REQUEST        :   文件请求,获取文件成功
         INTERNAL_ERROR      :   表示服务器内部错误
         CLOSED_CONNECTION   :   表示客户端已经关闭连接了
+        NOT_MODIFIED        :   the client's copy is current (conditional GET), 304 without a body
+        PARTIAL_CONTENT     :   the byte ranges in m_ranges of the file, 206
+        RANGE_NOT_SATISFIABLE : no range asked for overlaps the file, 416
     */
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION, NOT_MODIFIED,
+                     PARTIAL_CONTENT, RANGE_NOT_SATISFIABLE };
 
     // 从状态机的三种可能状态，即行的读取状态，分别表示
     // 1.读取到一个完整的行 2.行出错 3.行数据尚且不完整
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
 
+    // reactor mode: the socket operation a worker has to do for this connection.
+    enum IO_STATE { IO_READ = 0, IO_WRITE };
+
+    // thread pool lane: cheap requests are served before expensive ones.
+    enum PRIORITY { PRIORITY_HIGH = 0, PRIORITY_LOW };
+    static const int LARGE_FILE_SIZE = 65536; // files from this size on take the low lane.
+    static const long DEFAULT_SENDFILE_THRESHOLD = 0; // measured faster from 512 bytes on, see bench_sendfile.sh.
+    static const long DEFAULT_INLINE_THRESHOLD = 8192; // copies lose to sendfile at 64 KB, see bench_inline.sh.
+
 public:
     http_conn() {};
     ~http_conn() {};
 
 public:
-    void init(int sockfd, const sockaddr_in &addr);
+    void init(int sockfd, const sockaddr_in &addr, int epollfd = m_epollfd);
     void close_conn();
-    void process();
+    void reject(); // answer 503 and close, for requests the server is too busy for.
+    static void send_busy(int sockfd);
+    static void print_stats();
+    bool process(); // false if the connection was closed.
     bool read();
     bool write();
+    // by the event loop after read(), before the connection is queued: m_priority from the next
+    // request in m_read_buf, the size of its file or its body.
+    void classify();
+
+    // Completion based I/O (uring_loop): the loop owns the socket syscalls and
+    // these only move bytes in and out of the connection buffers.
+    int fill_read(const char *data, int len); // the bytes that fit the read buffer, at most len.
+    int read_room() const { return READ_BUFFER_SIZE - m_read_idx; }
+    int prepare_response(); // 1 responses ready, 0 request incomplete, -1 failed or head too large.
+    int write_iov(struct iovec **iv); // the part of the responses still to be sent.
+    int on_write(int bytes); // 1 more to send, 0 done and kept alive, -1 done and to be closed.
+
+    // value of a known request header of the current request, nullptr if it wasn't sent.
+    inline const char* header(http_header::ID id) const {
+        return m_headers[id].length < 0 ? nullptr : m_read_buf + m_headers[id].offset;
+    }
 
 private:
+    // a queued response: its text ends at head_end in m_write_buf, after the previous one's. The
+    // text is interleaved with its slices of the file: the head, the body (or a part head and a
+    // range per part of a multipart body), and the closing boundary.
+    struct response {
+        int head_end;
+        char *file_address; // mmap of the body, nullptr for none.
+        off_t file_size; // length of the mapping.
+        int file_fd; // or the file to sendfile the body from, -1 for none.
+        file_cache::entry *cache_entry; // the mapping or file are the cache's, nullptr if they are its own.
+        int slice_end; // its slices end here in m_slices, after the previous one's.
+        bool keep_alive;
+    };
+
+    // file bytes [offset, offset + length) of the mapping (of the file, if sent with sendfile),
+    // sent after the text up to text_end.
+    struct slice {
+        int text_end;
+        off_t offset;
+        off_t length;
+    };
+
+    struct byte_range {
+        off_t first;
+        off_t last; // inclusive, as in Content-Range.
+    };
+
     void init();
+    void init_request(); // parser state for the next request, the bytes read are kept.
+    void init_response(); // nothing queued to write.
+    void consume_request(int end); // drop the bytes of a parsed request from m_read_buf.
+    void build_iov();
+    void add_iov(char *base, size_t length); // joined to the previous iovec if it continues it.
+    void add_file_iov(int fd, off_t offset, off_t length);
+    ssize_t send_iov(); // the text up to the next file part, or that file part.
     HTTP_CODE process_read(); // analyze HTTP request
     bool process_write(HTTP_CODE ret); // fill HTTP response
 
@@ -76,30 +157,61 @@ private:
     HTTP_CODE parse_headers(char* text);
     HTTP_CODE parse_content(char* text);
     HTTP_CODE do_request();
+    HTTP_CODE parse_range(); // m_ranges from the Range header, see the definition.
     inline char * get_line() {return m_read_buf + m_start_line;}
     LINE_STATUS parse_line(); // get one line by \r\n.
 
     // 这一组函数被process_write调用以填充HTTP应答。
-    void unmap();
+    void unmap(); // all queued files, and the current one.
+    void close_file(); // the current file: unmapped, closed if sent with sendfile, or given back to the cache.
     bool add_response(const char* format, ...);
     bool add_content(const char* content);
     bool add_content_type();
     bool add_status_line(int status, const char* title);
-    bool add_headers(int content_len);
-    bool add_content_length(int content_len);
+    bool add_headers(long content_len);
+    bool add_content_length(long content_len);
     bool add_linger();
     bool add_blank_line();
+    bool add_validators(); // ETag and Last-Modified of m_file_stat.
+    bool add_multipart(); // the multipart/byteranges head and body of m_ranges.
+    bool add_slice(const byte_range &range); // the range goes out after what m_write_buf has now.
+
+    // validators of the file in m_file_stat.
+    int format_etag(char *buf, int size) const;
+    bool not_modified() const; // If-None-Match / If-Modified-Since say the client's copy is current.
+    bool range_current() const; // If-Range, if sent, names the file as it is.
 
 public:
-    static int m_epollfd; // 所有socket上的事件都被注册到同一个epoll内核事件中.
-    static int m_user_count; // # of clients.
+    static int m_epollfd; // 所有socket上的事件都被注册到同一个epoll内核事件中(single reactor model).
+    static std::atomic<int> m_user_count; // # of clients, shared by all reactors.
+    // persistent connections: requests answered, how many of them on a connection that had
+    // answered one before (a reconnect saved), and connections closed because the request asked.
+    static std::atomic<unsigned long> m_requests;
+    static std::atomic<unsigned long> m_reused;
+    static std::atomic<unsigned long> m_close_requested;
+    static std::atomic<unsigned long> m_not_modified; // 304s: no open, no mmap, no body.
+    static std::atomic<unsigned long> m_partial; // 206s.
+    // bodies (the part of the file sent) from this size on go out with sendfile instead of being
+    // mapped, -1 for never. Set before the server starts.
+    static long m_sendfile_threshold;
+    static file_cache *m_file_cache; // open files shared by all connections, nullptr for none.
+    // bodies smaller than this are sent from memory without a mapping: the file cache's copy, or
+    // read into m_write_buf behind the head. Before m_sendfile_threshold is looked at.
+    static long m_inline_threshold;
+    IO_STATE m_io_state; // set by the event loop before the connection is handed to a worker.
+    int m_last_worker; // thread pool worker that served the connection last, -1 for none yet.
+    // set by classify(), and when a request is parsed. Without classify() (the workers read, -a
+    // reactor) a read task is queued with the class of the previous request.
+    PRIORITY m_priority;
 
 private:
     int m_sockfd; // the socket connected with this HTTP.
+    int m_conn_epollfd; // the epoll object this socket is registered on.
     sockaddr_in m_address; // IP
 
     char m_read_buf[READ_BUFFER_SIZE];
     int m_read_idx;
+    // bytes [0, m_read_idx) are the current request and possibly more pipelined after it.
     int m_checked_idx; // the position of the character under analyzing in the buffer.
     int m_start_line; // the beginning position of the line under analyzing
 
@@ -110,18 +222,39 @@ private:
     char *m_url; // object file name;
     char *m_version; // version of the protocol
     char *m_host; // name of host
-    bool m_linger; // HTTP request keeps the connection or not
+    bool m_linger; // HTTP request keeps the connection or not: HTTP/1.1 unless "close", HTTP/1.0 if "keep-alive".
     int m_content_length; // the length of the HTTP request message
+    http_header::value m_headers[http_header::COUNT]; // known headers, the first of each name.
 
     char m_write_buf[WRITE_BUFFER_SIZE];
     int m_write_idx;
     char *m_file_address; // 客户请求的目标文件被mmap到内存中的起始位置
+    off_t m_file_size; // length of the mapping: the part of the file that is sent.
+    off_t m_map_offset; // where in the file the mapping starts, page aligned.
+    int m_file_fd; // instead of the mapping, the open file for sendfile, -1 for none.
+    file_cache::entry *m_cache_entry; // the mapping or the fd are this entry's, nullptr if they are our own.
+    bool m_read_body; // the body is small: add_slice() reads it from m_file_fd into m_write_buf.
     struct stat m_file_stat; // status of the target file
-    struct iovec m_iv[2]; // 我们将采用writev来执行写操作，所以定义下面两个成员，其中m_iv_count表示被写内存块的数量。
+    byte_range m_ranges[MAX_RANGES]; // of a PARTIAL_CONTENT request, in the order asked.
+    int m_range_count;
+    response m_responses[MAX_PIPELINE]; // answered requests, in order.
+    int m_response_count;
+    int m_served; // requests answered on this connection.
+    slice m_slices[MAX_SLICES]; // of the queued responses, in order.
+    int m_slice_count;
+    // 我们将采用writev来执行写操作: a text and a slice at most per slice, and the text after the
+    // last slice per response. Texts next to each other share one.
+    // A file part sent with sendfile has a nullptr iov_base, its file and offset are in m_iv_file.
+    struct iovec m_iv[2 * MAX_SLICES + MAX_PIPELINE];
+    struct file_part {
+        int fd;
+        off_t offset;
+    } m_iv_file[2 * MAX_SLICES + MAX_PIPELINE];
     int m_iv_count;
+    int m_iv_index; // first iovec not completely sent.
+    bool m_corked; // TCP_CORK is on while a batch sends more after a sendfile.
 
-    int bytes_to_send = 0;
-    int bytes_have_send = 0;
+    long bytes_to_send = 0;
 };
 
 #endif //WEBSERVER_HTTP_CONN_H
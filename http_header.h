@@ -0,0 +1,88 @@
+#ifndef WEBSERVER_HTTP_HEADER_H
+#define WEBSERVER_HTTP_HEADER_H
+
+#include <strings.h>
+
+/*
+ * The request headers the server knows, and a perfect hash over their names computed at
+ * compile time: a name is found with one hash (its length and two of its characters) and one
+ * strncasecmp against the only candidate. Adding a name that collides fails the static_assert
+ * below; change HASH_LEN/HASH_FIRST/HASH_LAST then.
+ */
+class http_header {
+public:
+    enum ID {
+        ACCEPT = 0, ACCEPT_CHARSET, ACCEPT_ENCODING, ACCEPT_LANGUAGE, AUTHORIZATION, CACHE_CONTROL,
+        CONNECTION, CONTENT_LENGTH, CONTENT_TYPE, COOKIE, EXPECT, HOST, IF_MATCH, IF_MODIFIED_SINCE,
+        IF_NONE_MATCH, IF_RANGE, IF_UNMODIFIED_SINCE, ORIGIN, PRAGMA, RANGE, REFERER,
+        TRANSFER_ENCODING, UPGRADE, USER_AGENT,
+        COUNT, UNKNOWN = -1
+    };
+
+    // a header value, as offsets into the buffer it was parsed from (NUL terminated there).
+    struct value {
+        int offset;
+        int length; // -1 if the header wasn't sent.
+    };
+
+    // the ID of name[0, length), UNKNOWN if it isn't one of ours.
+    static inline ID lookup(const char *name, int length);
+    static inline const char* name(ID id);
+
+    static const int TABLE_SIZE = 64; // a power of two
+    static const int HASH_LEN = 1, HASH_FIRST = 3, HASH_LAST = 35;
+    static const int MIN_LENGTH = 4; // hash() reads name[length - 2]
+
+    static constexpr int lower(char c){
+        return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : (unsigned char) c;
+    }
+    static constexpr int hash(const char *name, int length){
+        return (length * HASH_LEN + lower(name[0]) * HASH_FIRST + lower(name[length - 2]) * HASH_LAST)
+               & (TABLE_SIZE - 1);
+    }
+};
+
+// in the order of http_header::ID.
+constexpr const char *HTTP_HEADER_NAMES[http_header::COUNT] = {
+    "Accept", "Accept-Charset", "Accept-Encoding", "Accept-Language", "Authorization", "Cache-Control",
+    "Connection", "Content-Length", "Content-Type", "Cookie", "Expect", "Host", "If-Match",
+    "If-Modified-Since", "If-None-Match", "If-Range", "If-Unmodified-Since", "Origin", "Pragma",
+    "Range", "Referer", "Transfer-Encoding", "Upgrade", "User-Agent"
+};
+
+// hash slot -> ID, built by the compiler.
+struct http_header_table {
+    signed char id[http_header::TABLE_SIZE];
+    int length[http_header::COUNT];
+    bool perfect; // no two names share a slot.
+
+    constexpr http_header_table(): id(), length(), perfect(true) {
+        for(int i = 0; i < http_header::TABLE_SIZE; i++) id[i] = -1;
+        for(int i = 0; i < http_header::COUNT; i++) {
+            int n = 0;
+            while(HTTP_HEADER_NAMES[i][n]) n++;
+            length[i] = n;
+            if (n < http_header::MIN_LENGTH) perfect = false;
+            int slot = http_header::hash(HTTP_HEADER_NAMES[i], n);
+            if (id[slot] >= 0) perfect = false;
+            id[slot] = (signed char) i;
+        }
+    }
+};
+
+constexpr http_header_table HTTP_HEADER_TABLE = http_header_table();
+static_assert(HTTP_HEADER_TABLE.perfect, "http header names collide in the hash table");
+
+inline http_header::ID http_header::lookup(const char *name, int length){
+    if (length < MIN_LENGTH) return UNKNOWN;
+    int id = HTTP_HEADER_TABLE.id[hash(name, length)];
+    if (id < 0 || HTTP_HEADER_TABLE.length[id] != length
+        || strncasecmp(name, HTTP_HEADER_NAMES[id], length) != 0) return UNKNOWN;
+    return (ID) id;
+}
+
+inline const char* http_header::name(ID id){
+    return HTTP_HEADER_NAMES[id];
+}
+
+#endif //WEBSERVER_HTTP_HEADER_H
@@ -0,0 +1,105 @@
+#include "leader_follower.h"
+#include "topology.h"
+#include <exception>
+
+extern void addfd(int epollfd, int fd, bool one_shot);
+extern void modfd(int epollfd, int fd, int ev);
+
+leader_follower::leader_follower(http_conn *users, int max_fd, int listenfd, int thread_number,
+                                 int accept_budget, const std::vector<int> &cpus):
+        m_users(users), m_max_fd(max_fd), m_listenfd(listenfd), m_thread_number(thread_number), m_cpus(cpus),
+        m_epollfd(-1), m_acceptor(listenfd, max_fd, accept_budget), m_leader_locker("leader") {
+    if (thread_number <= 0) {
+        throw std::exception();
+    }
+    m_epollfd = epoll_create(5);
+    if (m_epollfd < 0) {
+        throw std::exception();
+    }
+    addfd(m_epollfd, m_listenfd, true);
+    http_conn::m_epollfd = m_epollfd;
+}
+
+leader_follower::~leader_follower() {
+    close(m_epollfd);
+}
+
+bool leader_follower::start() {
+    for(int i = 0; i < m_thread_number; i++) {
+        pthread_t tid;
+        printf("Creating the %d th leader/follower thread...\n", i);
+        if (pthread_create(&tid, nullptr, worker, this) != 0) {
+            return false;
+        }
+        m_threads.push_back(tid);
+        if (!m_cpus.empty() && !pin_thread(tid, m_cpus[i % m_cpus.size()])) {
+            printf("Failed to pin thread %d to cpu %d.\n", i, m_cpus[i % m_cpus.size()]);
+        }
+    }
+    return true;
+}
+
+void leader_follower::join() {
+    for(auto tid : m_threads) {
+        pthread_join(tid, nullptr);
+    }
+}
+
+void* leader_follower::worker(void *arg) {
+    auto *lf = (leader_follower*) arg;
+    lf->run();
+    return lf;
+}
+
+void leader_follower::handle_accept() {
+    m_acceptor.accept_conns([this](int connfd, const sockaddr_in &addr) {
+        m_users[connfd].init(connfd, addr, m_epollfd);
+    });
+    // level triggered after the re-arm, so a backlog left over by the budget fires again at once.
+    modfd(m_epollfd, m_listenfd, EPOLLIN);
+}
+
+void leader_follower::handle_event(const epoll_event &event) {
+    int sockfd = event.data.fd;
+    if (sockfd == m_listenfd) {
+        handle_accept();
+    }
+    else if (event.events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        m_users[sockfd].close_conn();
+    }
+    else if (event.events & EPOLLIN) {
+        // read, parse and respond on this thread, process() re-arms the fd.
+        if (!m_users[sockfd].read()) {
+            m_users[sockfd].close_conn();
+        } else {
+            m_users[sockfd].process();
+        }
+    }
+    else if (event.events & EPOLLOUT) {
+        if (!m_users[sockfd].write()) {
+            m_users[sockfd].close_conn();
+        }
+    }
+}
+
+void leader_follower::run() {
+    while(true) {
+        // become the leader.
+        m_leader_locker.lock();
+        epoll_event event;
+        int num;
+        do {
+            num = epoll_wait(m_epollfd, &event, 1, -1);
+        } while(num < 0 && errno == EINTR);
+        // promote a follower before handling the event.
+        m_leader_locker.unlock();
+
+        if (num < 0) {
+            printf("EPOLL failure.\n");
+            break;
+        }
+        if (num > 0) {
+            handle_event(event);
+        }
+    }
+}
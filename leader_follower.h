@@ -0,0 +1,49 @@
+#ifndef WEBSERVER_LEADER_FOLLOWER_H
+#define WEBSERVER_LEADER_FOLLOWER_H
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <vector>
+#include "http_conn.h"
+#include "locker.h"
+#include "acceptor.h"
+
+/*
+ * class leader_follower
+ * A set of threads sharing one epoll object. The thread holding m_leader_locker is the
+ * leader and the only one in epoll_wait(); the others (followers) wait on the lock.
+ * The leader takes a single ready fd, promotes a follower by releasing the lock and then
+ * handles the fd itself, so a request is never queued or handed to another thread.
+ * Every fd, the listening socket included, is armed with EPOLLONESHOT: no two threads
+ * can get the same fd until its handler re-arms it.
+ */
+class leader_follower {
+public:
+    // thread i is pinned to cpus[i % cpus.size()], no pinning if cpus is empty.
+    leader_follower(http_conn *users, int max_fd, int listenfd, int thread_number,
+                    int accept_budget = acceptor::DEFAULT_BUDGET,
+                    const std::vector<int> &cpus = std::vector<int>());
+    ~leader_follower();
+
+    bool start(); // create the threads
+    void join();
+
+private:
+    static void* worker(void *arg);
+    void run();
+    void handle_accept();
+    void handle_event(const epoll_event &event);
+
+private:
+    http_conn *m_users; // connection table, indexed by fd.
+    int m_max_fd;
+    int m_listenfd;
+    int m_thread_number;
+    std::vector<int> m_cpus;
+    int m_epollfd;
+    acceptor m_acceptor; // only used by the thread that got the listenfd event.
+    std::vector<pthread_t> m_threads;
+    locker m_leader_locker; // held by the leader while it waits for events.
+};
+
+#endif //WEBSERVER_LEADER_FOLLOWER_H
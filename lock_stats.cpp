@@ -0,0 +1,93 @@
+#include "lock_stats.h"
+#include <pthread.h>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+// slot MAX_SITES collects the sites that didn't get one.
+struct thread_slots {
+    lock_stats::counters sites[lock_stats::MAX_SITES + 1];
+};
+
+// a plain pthread mutex: the instrumented locks count through here.
+pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+const char *site_names[lock_stats::MAX_SITES];
+std::atomic<int> site_count(0);
+// never freed, threads may still exit while the process does.
+std::vector<thread_slots*> *live_threads = new std::vector<thread_slots*>();
+thread_slots retired; // the counts of threads that have exited.
+
+void fold(lock_stats::counters &to, const lock_stats::counters &from) {
+    lock_stats::add(to.acquires, from.acquires.load(std::memory_order_relaxed));
+    lock_stats::add(to.contended, from.contended.load(std::memory_order_relaxed));
+    lock_stats::add(to.wait_ns, from.wait_ns.load(std::memory_order_relaxed));
+    lock_stats::add(to.hold_ns, from.hold_ns.load(std::memory_order_relaxed));
+    uint64_t max_wait = from.max_wait_ns.load(std::memory_order_relaxed);
+    if (max_wait > to.max_wait_ns.load(std::memory_order_relaxed)) {
+        to.max_wait_ns.store(max_wait, std::memory_order_relaxed);
+    }
+}
+
+// the slots of the calling thread, registered on first use and folded into retired at its exit.
+struct thread_guard {
+    thread_slots *slots = nullptr;
+
+    ~thread_guard() {
+        if (!slots) return;
+        pthread_mutex_lock(&registry_mutex);
+        for(int i = 0; i < lock_stats::MAX_SITES; i++) fold(retired.sites[i], slots->sites[i]);
+        for(auto it = live_threads->begin(); it != live_threads->end(); ++it) {
+            if (*it == slots) {
+                live_threads->erase(it);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&registry_mutex);
+        delete slots;
+    }
+};
+
+thread_local thread_guard guard;
+
+}
+
+int lock_stats::register_site(const char *name) {
+    pthread_mutex_lock(&registry_mutex);
+    int site = site_count.load(std::memory_order_relaxed);
+    if (site < MAX_SITES) {
+        site_names[site] = name;
+        site_count.store(site + 1, std::memory_order_release);
+    } else {
+        site = -1;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return site;
+}
+
+lock_stats::counters* lock_stats::local(int site) {
+    if (!guard.slots) {
+        guard.slots = new thread_slots();
+        pthread_mutex_lock(&registry_mutex);
+        live_threads->push_back(guard.slots);
+        pthread_mutex_unlock(&registry_mutex);
+    }
+    return &guard.slots->sites[site >= 0 ? site : MAX_SITES];
+}
+
+void lock_stats::print() {
+    pthread_mutex_lock(&registry_mutex);
+    int count = site_count.load(std::memory_order_acquire);
+    for(int site = 0; site < count; site++) {
+        counters total = {};
+        fold(total, retired.sites[site]);
+        for(auto slots : *live_threads) fold(total, slots->sites[site]);
+        uint64_t acquires = total.acquires, contended = total.contended;
+        if (acquires == 0) continue;
+        printf("lock %d %s: acquires %lu, contended %lu (%.2f%%), wait avg %.1fus max %.1fus, hold avg %.2fus.\n",
+               site, site_names[site], acquires, contended, 100.0 * contended / acquires,
+               contended ? total.wait_ns / 1000.0 / contended : 0.0, total.max_wait_ns / 1000.0,
+               total.hold_ns / 1000.0 / acquires);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+}
@@ -0,0 +1,50 @@
+#ifndef WEBSERVER_LOCK_STATS_H
+#define WEBSERVER_LOCK_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+/*
+ * Contention counters of the instrumented locker and sem (built with WEBSERVER_LOCK_STATS,
+ * cmake -DLOCK_STATS=ON). Every lock registers a named site when it is constructed. Every
+ * thread counts into slots of its own, written by that thread only, so counting takes no lock
+ * and no shared cache line; print() adds up the slots of all threads.
+ */
+class lock_stats {
+public:
+    static const int MAX_SITES = 256;
+
+    struct counters {
+        std::atomic<uint64_t> acquires;
+        std::atomic<uint64_t> contended; // acquires that had to wait.
+        std::atomic<uint64_t> wait_ns;
+        std::atomic<uint64_t> max_wait_ns;
+        std::atomic<uint64_t> hold_ns;   // lockers only.
+    };
+
+    // a new site, -1 once MAX_SITES are taken (its numbers are not printed then).
+    static int register_site(const char *name);
+    // the calling thread's counters for site.
+    static counters* local(int site);
+    static void print();
+
+    static inline uint64_t now_ns(){
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    // only the owning thread writes, a plain load and store is enough.
+    static inline void add(std::atomic<uint64_t> &counter, uint64_t value){
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    static inline void record_wait(counters *c, uint64_t wait){
+        add(c->contended, 1);
+        add(c->wait_ns, wait);
+        if (wait > c->max_wait_ns.load(std::memory_order_relaxed)) {
+            c->max_wait_ns.store(wait, std::memory_order_relaxed);
+        }
+    }
+};
+
+#endif //WEBSERVER_LOCK_STATS_H
@@ -4,13 +4,13 @@
 
 #include "locker.h"
 
-locker::locker(){
+pthread_locker::pthread_locker(const char *){
     if (pthread_mutex_init(&m_mutex, nullptr) != 0) {
         throw std::exception();
     }
 }
 
-locker::~locker(){
+pthread_locker::~pthread_locker(){
     pthread_mutex_destroy(&m_mutex);
 }
 
@@ -24,18 +24,12 @@ cond::~cond(){
     pthread_cond_destroy(&m_cond);
 }
 
-sem::sem(){
-    if (sem_init(&m_sem, 0, 0) != 0){
-        throw std::exception();
-    }
-}
-
-sem::sem(int num){
+pthread_sem::pthread_sem(int num, const char *){
     if (sem_init(&m_sem, 0, num) != 0){
         throw std::exception();
     }
 }
 
-sem::~sem(){
+pthread_sem::~pthread_sem(){
     sem_destroy(&m_sem);
 }
\ No newline at end of file
@@ -8,15 +8,29 @@
 #include <pthread.h>
 #include <exception>
 #include <semaphore.h>
+#include <atomic>
+#include <climits>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#ifdef WEBSERVER_LOCK_STATS
+#include "lock_stats.h"
+#endif
 
-//
-class locker {
+// pthread/POSIX wrappers. locker and sem below are these, or the futex based ones if the
+// server is built with WEBSERVER_FUTEX_LOCKS (cmake -DFUTEX_LOCKS=ON), and are wrapped in
+// instrumented_locker/instrumented_sem with WEBSERVER_LOCK_STATS (cmake -DLOCK_STATS=ON).
+// The name of a lock is only used by the instrumented build.
+class pthread_locker {
 public:
-    locker();
-    ~locker();
+    explicit pthread_locker(const char *name = nullptr);
+    ~pthread_locker();
     inline bool lock(){
         return pthread_mutex_lock(&m_mutex);
     };
+    inline bool try_lock(){
+        return pthread_mutex_trylock(&m_mutex) == 0;
+    }
     inline bool unlock(){
         return pthread_mutex_unlock(&m_mutex);
     }
@@ -28,6 +42,7 @@ private:
     pthread_mutex_t m_mutex;
 };
 
+// waits with a pthread_locker's mutex.
 class cond{
 public:
     cond();
@@ -53,14 +68,16 @@ private:
     pthread_cond_t m_cond;
 };
 
-class sem{
+class pthread_sem{
 public:
-    sem();
-    sem(int num);
-    ~sem();
+    explicit pthread_sem(int num = 0, const char *name = nullptr);
+    ~pthread_sem();
     inline bool wait(){
         return sem_wait(&m_sem) == 0;
     }
+    inline bool try_wait(){
+        return sem_trywait(&m_sem) == 0;
+    }
     inline bool post(){
         return sem_post(&m_sem) == 0;
     }
@@ -69,4 +86,278 @@ private:
     sem_t m_sem{};
 };
 
+// block while *addr == expected, returns at once if it isn't (anymore). Spurious wakeups happen.
+inline void futex_wait(std::atomic<unsigned> *addr, unsigned expected){
+    syscall(SYS_futex, (unsigned*) addr, FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<unsigned> *addr, int count){
+    syscall(SYS_futex, (unsigned*) addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+/*
+ * Adaptive spinning, as glibc's PTHREAD_MUTEX_ADAPTIVE_NP: a lock or semaphore remembers how
+ * long acquiring it took while spinning and spins up to about twice that before it parks.
+ * A lock held for long drifts towards parking right away, a short critical section towards
+ * spinning. Never spins on a single cpu, the holder can't run meanwhile.
+ */
+class spin_policy{
+public:
+    static const int MAX_SPINS = 100;
+
+    spin_policy(): m_spins(0) {}
+
+    // try acquire() while spinning, true as soon as it succeeded.
+    template<typename F>
+    inline bool spin(F acquire){
+        static const bool multi_cpu = sysconf(_SC_NPROCESSORS_ONLN) > 1;
+        if (!multi_cpu) return false;
+        int spins = m_spins.load(std::memory_order_relaxed);
+        int limit = spins * 2 + 10 < MAX_SPINS ? spins * 2 + 10 : MAX_SPINS;
+        for(int i = 0; i < limit; i++) {
+            if (acquire()) {
+                m_spins.store(spins + (i - spins) / 8, std::memory_order_relaxed);
+                return true;
+            }
+            pause();
+        }
+        m_spins.store(spins + (limit - spins) / 8, std::memory_order_relaxed);
+        return false;
+    }
+
+private:
+    static inline void pause(){
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    std::atomic<int> m_spins; // estimate of the spins an acquire takes.
+};
+
+/*
+ * Mutex on a futex word ("Futexes Are Tricky", mutex 3): 0 free, 1 locked, 2 locked and
+ * somebody may sleep. Uncontended lock and unlock are one atomic each, unlock only enters
+ * the kernel if the word was 2.
+ */
+class futex_locker{
+public:
+    explicit futex_locker(const char * /* name */ = nullptr): m_state(0) {}
+
+    inline bool lock(){
+        unsigned c = 0;
+        if (m_state.compare_exchange_strong(c, 1, std::memory_order_acquire)) return true;
+        if (m_spin.spin([this]{ unsigned free = 0;
+                                return m_state.compare_exchange_weak(free, 1, std::memory_order_acquire); })) {
+            return true;
+        }
+        // we may sleep, so whoever unlocks next has to wake somebody.
+        if (c != 2) c = m_state.exchange(2, std::memory_order_acquire);
+        while(c != 0) {
+            futex_wait(&m_state, 2);
+            c = m_state.exchange(2, std::memory_order_acquire);
+        }
+        return true;
+    }
+    inline bool try_lock(){
+        unsigned c = 0;
+        return m_state.compare_exchange_strong(c, 1, std::memory_order_acquire);
+    }
+    inline bool unlock(){
+        if (m_state.fetch_sub(1, std::memory_order_release) != 1) {
+            m_state.store(0, std::memory_order_release);
+            futex_wake(&m_state, 1);
+        }
+        return true;
+    }
+
+private:
+    std::atomic<unsigned> m_state;
+    spin_policy m_spin;
+};
+
+/*
+ * Counting semaphore on a futex word. post() only enters the kernel if a waiter sleeps,
+ * wait() spins for a post before it sleeps.
+ */
+class futex_sem{
+public:
+    explicit futex_sem(int num = 0, const char * /* name */ = nullptr): m_count(num), m_waiters(0) {
+        if (num < 0) {
+            throw std::exception();
+        }
+    }
+
+    inline bool wait(){
+        if (try_wait() || m_spin.spin([this]{ return try_wait(); })) return true;
+        // the seq_cst pair with post(): either we see its count or it sees us waiting.
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        while(!try_wait()) {
+            futex_wait(&m_count, 0);
+        }
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+    inline bool post(){
+        m_count.fetch_add(1, std::memory_order_seq_cst);
+        if (m_waiters.load(std::memory_order_seq_cst) > 0) {
+            futex_wake(&m_count, 1);
+        }
+        return true;
+    }
+    inline bool try_wait(){
+        unsigned count = m_count.load(std::memory_order_seq_cst);
+        while(count > 0) {
+            if (m_count.compare_exchange_weak(count, count - 1, std::memory_order_acquire)) return true;
+        }
+        return false;
+    }
+
+private:
+    std::atomic<unsigned> m_count;
+    std::atomic<int> m_waiters;
+    spin_policy m_spin;
+};
+
+#ifdef WEBSERVER_LOCK_STATS
+/*
+ * Wrappers counting acquires, contended acquires, wait and hold time per named lock into
+ * lock_stats. An acquire is contended if try_lock()/try_wait() fails, only then is the wait
+ * timed. Waiting on a cond through get() is not counted.
+ */
+template<typename L>
+class instrumented_locker {
+public:
+    explicit instrumented_locker(const char *name = nullptr):
+            m_site(lock_stats::register_site(name ? name : "unnamed locker")), m_acquired_ns(0) {}
+
+    inline bool lock(){
+        lock_stats::counters *c = lock_stats::local(m_site);
+        if (!m_lock.try_lock()) {
+            uint64_t start = lock_stats::now_ns();
+            m_lock.lock();
+            lock_stats::record_wait(c, lock_stats::now_ns() - start);
+        }
+        lock_stats::add(c->acquires, 1);
+        m_acquired_ns = lock_stats::now_ns(); // we hold the lock, nobody else writes it.
+        return true;
+    }
+    inline bool try_lock(){
+        if (!m_lock.try_lock()) return false;
+        lock_stats::add(lock_stats::local(m_site)->acquires, 1);
+        m_acquired_ns = lock_stats::now_ns();
+        return true;
+    }
+    inline bool unlock(){
+        lock_stats::add(lock_stats::local(m_site)->hold_ns, lock_stats::now_ns() - m_acquired_ns);
+        return m_lock.unlock();
+    }
+    inline pthread_mutex_t *get(){
+        return m_lock.get();
+    }
+
+private:
+    L m_lock;
+    int m_site;
+    uint64_t m_acquired_ns;
+};
+
+template<typename S>
+class instrumented_sem {
+public:
+    explicit instrumented_sem(int num = 0, const char *name = nullptr):
+            m_sem(num), m_site(lock_stats::register_site(name ? name : "unnamed sem")) {}
+
+    inline bool wait(){
+        lock_stats::counters *c = lock_stats::local(m_site);
+        if (!m_sem.try_wait()) {
+            uint64_t start = lock_stats::now_ns();
+            m_sem.wait();
+            lock_stats::record_wait(c, lock_stats::now_ns() - start);
+        }
+        lock_stats::add(c->acquires, 1);
+        return true;
+    }
+    inline bool try_wait(){
+        if (!m_sem.try_wait()) return false;
+        lock_stats::add(lock_stats::local(m_site)->acquires, 1);
+        return true;
+    }
+    inline bool post(){
+        return m_sem.post();
+    }
+
+private:
+    S m_sem;
+    int m_site;
+};
+#endif
+
+#ifdef WEBSERVER_FUTEX_LOCKS
+typedef futex_locker base_locker;
+typedef futex_sem base_sem;
+#else
+typedef pthread_locker base_locker;
+typedef pthread_sem base_sem;
+#endif
+
+#ifdef WEBSERVER_LOCK_STATS
+typedef instrumented_locker<base_locker> locker;
+typedef instrumented_sem<base_sem> sem;
+#else
+typedef base_locker locker;
+typedef base_sem sem;
+#endif
+
+/*
+ * Lets consumers of a lock-free queue sleep while it is empty, without a syscall on the
+ * producer side as long as nobody sleeps. A consumer takes a key with prepare_wait(),
+ * checks the queue once more and then either cancel_wait()s or wait()s; a notify after
+ * the key was taken makes wait() return at once, so a wakeup cannot get lost.
+ */
+class event_count{
+public:
+    event_count(): m_seq(0), m_waiters(0) {}
+
+    inline unsigned prepare_wait(){
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+        unsigned key = m_seq.load(std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // orders the waiters store before the queue is checked again
+        return key;
+    }
+    inline void cancel_wait(){
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // true if a consumer has taken a key and not returned from wait() yet.
+    inline bool waiting() const{
+        return m_waiters.load(std::memory_order_relaxed) > 0;
+    }
+    inline void wait(unsigned key){
+        futex_wait(&m_seq, key);
+        m_waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // called after the item was published.
+    inline void notify_one(){
+        notify(1);
+    }
+    inline void notify_all(){
+        notify(INT_MAX);
+    }
+
+private:
+    inline void notify(int count){
+        std::atomic_thread_fence(std::memory_order_seq_cst); // orders the push before the waiters load
+        if (m_waiters.load(std::memory_order_relaxed) == 0) return;
+        m_seq.fetch_add(1, std::memory_order_seq_cst);
+        futex_wake(&m_seq, count);
+    }
+
+private:
+    std::atomic<unsigned> m_seq;
+    std::atomic<int> m_waiters;
+};
+
 #endif //WEBSERVER_LOCKER_H
@@ -11,9 +11,18 @@
 #include <sys/epoll.h>
 #include <libgen.h>
 #include <csignal>
+#include <getopt.h>
+#include <linux/filter.h>
+#include <vector>
+#include <new>
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
+#include "reactor.h"
+#include "acceptor.h"
+#include "uring.h"
+#include "leader_follower.h"
+#include "topology.h"
 
 #define MAX_FD 65535
 #define MAX_EVENT_NUMBER 10000
@@ -32,82 +41,318 @@ extern void addfd(int epollfd, int fd, bool one_shot);
 extern int removefd(int epollfd, int fd);
 extern void modfd(int epollfd, int fd, int ev);
 
-int main(int argc, char* argv[]) {
+extern const char* doc_root;
 
-    if (argc <= 1) {
-        printf("Run as: %s port number\n", basename(argv[0]));
-        exit(-1);
+// server architectures selectable by -m.
+enum MODEL { MODEL_SINGLE = 0, MODEL_REUSEPORT, MODEL_SUBREACTOR, MODEL_URING, MODEL_LEADER_FOLLOWER };
+
+// how the acceptor of the sub-reactor model picks a reactor for a new connection.
+enum DISPATCH { DISPATCH_ROUND_ROBIN = 0, DISPATCH_LEAST_LOADED };
+
+// command line options.
+struct server_config {
+    int port = 0;
+    MODEL model = MODEL_SINGLE;
+    int reactor_number = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    bool steering = false;
+    DISPATCH dispatch = DISPATCH_ROUND_ROBIN;
+    int backlog = acceptor::DEFAULT_BACKLOG;
+    int accept_budget = acceptor::DEFAULT_BUDGET;
+    bool worker_io = false; // single model: pool workers do the socket I/O (Reactor mode).
+    int thread_number = 8; // thread pool workers, the minimum if the pool may grow.
+    int max_thread_number = 0; // -T: the pool grows up to this many workers under load.
+    bool sticky = false; // -S: a connection stays with one pool worker, no stealing.
+    std::vector<int> cpus; // -c: threads are pinned to these cpus in turn, empty for no pinning.
+    long sendfile_threshold = http_conn::DEFAULT_SENDFILE_THRESHOLD; // -f
+    long cache_budget = file_cache::DEFAULT_BUDGET; // -C, 0 for no file cache.
+    long inline_threshold = http_conn::DEFAULT_INLINE_THRESHOLD; // -i
+};
+
+// cpu for the i-th reactor or thread, -1 without a cpu map.
+static int cpu_of(const server_config &config, int i) {
+    if (config.cpus.empty()) return -1;
+    return config.cpus[i % config.cpus.size()];
+}
+
+// connection tables of the NUMA nodes, created on first use.
+static std::vector<http_conn*> node_users;
+
+// With a cpu map on a NUMA machine, a loop pinned to a cpu gets a connection table allocated on
+// the cpu's node. The table is indexed by fd like the shared one; fds are unique in the process,
+// so every slot is only ever used in the table of the loop that owns the connection.
+static http_conn* users_for_cpu(http_conn *users, int cpu) {
+    if (cpu < 0 || numa_node_count() <= 1) return users;
+    int node = cpu_to_node(cpu);
+    if (node >= (int) node_users.size()) node_users.resize(node + 1, nullptr);
+    if (!node_users[node]) {
+        void *mem = alloc_on_node(sizeof(http_conn) * MAX_FD, node);
+        if (!mem) return users;
+        auto *table = (http_conn*) mem;
+        for(int i = 0; i < MAX_FD; i++) new(&table[i]) http_conn();
+        node_users[node] = table;
+        printf("Connection table for NUMA node %d.\n", node);
     }
+    return node_users[node];
+}
 
-    int port = atoi(argv[1]);
+static void free_node_users() {
+    for(auto table : node_users) {
+        if (!table) continue;
+        for(int i = 0; i < MAX_FD; i++) table[i].~http_conn();
+        free_on_node(table, sizeof(http_conn) * MAX_FD);
+    }
+    node_users.clear();
+}
 
-    addsig(SIGPIPE, SIG_IGN);
+// SIGUSR1 prints the counters. It is blocked in every thread and collected by a thread of its own,
+// so the event loops never get interrupted for it.
+static void* stats_worker(void *arg) {
+    auto *set = (sigset_t*) arg;
+    int sig;
+    while(sigwait(set, &sig) == 0) {
+        acceptor::print_stats();
+        threadpool<http_conn>::print_stats();
+        http_conn::print_stats();
+        if (http_conn::m_file_cache) file_cache::print_stats();
+#ifdef WEBSERVER_LOCK_STATS
+        lock_stats::print();
+#endif
+        fflush(stdout);
+    }
+    return nullptr;
+}
 
-    threadpool<http_conn> * pool = nullptr;
-    try{
-        pool = new threadpool<http_conn>;
-    } catch(...) {
-        exit(-1);
+// must run before any other thread is created so they all inherit the signal mask.
+static void start_stats_thread() {
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    pthread_t tid;
+    if (pthread_create(&tid, nullptr, stats_worker, &set) == 0) {
+        pthread_detach(tid);
     }
+}
 
-    http_conn *users = new http_conn[MAX_FD];
+// Steer every connection to the socket whose index in the reuseport group equals the cpu
+// that handled the SYN, so the reactor pinned to that cpu also serves the connection.
+static bool attach_cpu_steering(int listenfd) {
+    struct sock_filter code[] = {
+            { BPF_LD | BPF_W | BPF_ABS, 0, 0, (__u32) (SKF_AD_OFF + SKF_AD_CPU) }, // A = current cpu
+            { BPF_RET | BPF_A, 0, 0, 0 }, // return A
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof code / sizeof code[0];
+    prog.filter = code;
+    return setsockopt(listenfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog) == 0;
+}
+
+// startup failed half way: the reactors already running still use the connection table, which
+// main() frees once we return.
+static int stop_reactors(std::vector<reactor*> &reactors,
+                         const std::vector<int> &listenfds = std::vector<int>()) {
+    for(auto r : reactors) r->stop();
+    for(auto r : reactors) {
+        r->join();
+        delete r;
+    }
+    for(auto fd : listenfds) close(fd);
+    reactors.clear();
+    return -1;
+}
+
+// thread-per-core: every reactor owns a SO_REUSEPORT listening socket and an epoll object,
+// and serves its connections without handing them to the thread pool.
+static int run_reuseport(const server_config &config, http_conn *users) {
+    int cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int reactor_number = config.reactor_number;
+    bool steering = config.steering;
+    std::vector<int> listenfds;
+    std::vector<reactor*> reactors;
 
-    // monitor socket
-    int listenfd = socket(PF_INET, SOCK_STREAM, 0);
+    // the order of binding decides the index of the socket in the reuseport group.
+    for(int i = 0; i < reactor_number; i++) {
+        int listenfd = open_listenfd(config.port, true, config.backlog);
+        if (listenfd < 0) {
+            printf("Failed to bind reuseport socket %d.\n", i);
+            return stop_reactors(reactors, listenfds);
+        }
+        listenfds.push_back(listenfd);
+    }
+    if (steering) {
+        if (reactor_number != cpus) {
+            printf("CPU steering needs one reactor per cpu (%d).\n", cpus);
+            steering = false;
+        } else if (!attach_cpu_steering(listenfds[0])) {
+            printf("Failed to attach CBPF steering program.\n");
+            steering = false;
+        }
+    }
 
-    // Port multiplexing
-    int reuse = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof reuse);
+    for(int i = 0; i < reactor_number; i++) {
+        // reactor i has to run on cpu i for the steering program to keep connections local.
+        int cpu = steering ? i : cpu_of(config, i);
+        reactor *r = nullptr;
+        try {
+            r = new reactor(users_for_cpu(users, cpu), MAX_FD, listenfds[i], cpu, config.accept_budget);
+        } catch(...) {
+            return stop_reactors(reactors, listenfds);
+        }
+        printf("Creating the %d th reactor...\n", i);
+        if (!r->start()) {
+            delete r;
+            return stop_reactors(reactors, listenfds);
+        }
+        reactors.push_back(r);
+    }
+
+    for(auto r : reactors) {
+        r->join();
+        delete r;
+    }
+    for(auto fd : listenfds) close(fd);
+    return 0;
+}
+
+// main reactor / sub-reactors: this thread only accepts and hands every connection to one of
+// the sub-reactors, which own private epoll objects and are woken up through an eventfd.
+static int run_subreactor(const server_config &config, http_conn *users) {
+    int reactor_number = config.reactor_number;
+    std::vector<reactor*> reactors;
+    for(int i = 0; i < reactor_number; i++) {
+        int cpu = cpu_of(config, i);
+        reactor *r = nullptr;
+        try {
+            r = new reactor(users_for_cpu(users, cpu), MAX_FD, -1, cpu);
+        } catch(...) {
+            return stop_reactors(reactors);
+        }
+        printf("Creating the %d th sub-reactor...\n", i);
+        if (!r->start()) {
+            delete r;
+            return stop_reactors(reactors);
+        }
+        reactors.push_back(r);
+    }
+
+    int listenfd = open_listenfd(config.port, false, config.backlog);
+    if (listenfd < 0) {
+        printf("Failed to bind port %d.\n", config.port);
+        return stop_reactors(reactors);
+    }
+    // this thread takes the cpu after the sub-reactors' in the map.
+    int cpu = cpu_of(config, reactor_number);
+    if (cpu >= 0 && !pin_thread(pthread_self(), cpu)) {
+        printf("Failed to pin the acceptor to cpu %d.\n", cpu);
+    }
+    acceptor accept_engine(listenfd, MAX_FD, config.accept_budget);
+    epoll_event events[MAX_EVENT_NUMBER];
+    int epollfd = epoll_create(5);
+    addfd(epollfd, listenfd, false);
+
+    int next = 0;
+    auto dispatch_conn = [&](int connfd, const sockaddr_in &addr) {
+        reactor *target = reactors[next];
+        if (config.dispatch == DISPATCH_LEAST_LOADED) {
+            for(auto r : reactors) {
+                if (r->load() < target->load()) target = r;
+            }
+        }
+        next = (next + 1) % reactor_number;
+        target->add_conn(connfd, addr);
+    };
+
+    bool accept_pending = false; // the accept budget ran out before the backlog was drained.
+    while(true) {
+        // listenfd is the only fd here, so there is nothing to wait for while a backlog is left.
+        int num = accept_pending ? 1 : epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        if (num < 0 && (errno != EINTR)) {
+            printf("EPOLL failure.\n");
+            break;
+        }
+        if (num > 0) {
+            accept_pending = !accept_engine.accept_conns(dispatch_conn);
+        }
+    }
+
+    close(epollfd);
+    close(listenfd);
+    for(auto r : reactors) {
+        r->join();
+        delete r;
+    }
+    return 0;
+}
 
-    // Bind
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY; // any address
-    address.sin_port = htons(port); // host to network sequence
-    bind(listenfd, (struct sockaddr*)&address, sizeof address);
+// the original model: one epoll loop does all socket I/O, the thread pool parses and builds responses
+// (simulated Proactor). With worker_io the loop only waits for readiness and the workers also
+// read and write (Reactor), so the copying is spread over the pool instead of this thread.
+static int run_single(const server_config &config, http_conn *users) {
+    threadpool<http_conn> * pool = nullptr;
+    try{
+        pool = new threadpool<http_conn>(config.thread_number, 10000, config.worker_io, config.cpus,
+                                         config.max_thread_number, config.sticky);
+    } catch(...) {
+        return -1;
+    }
 
-    // Monitor
-    listen(listenfd, 5);
+    int listenfd = open_listenfd(config.port, false, config.backlog);
+    if (listenfd < 0) {
+        printf("Failed to bind port %d.\n", config.port);
+        return -1;
+    }
+    // the event loop is this thread, it shares the first cpu of the map with worker 0.
+    int cpu = cpu_of(config, 0);
+    if (cpu >= 0 && !pin_thread(pthread_self(), cpu)) {
+        printf("Failed to pin the event loop to cpu %d.\n", cpu);
+    }
+    acceptor accept_engine(listenfd, MAX_FD, config.accept_budget);
+    auto init_conn = [users](int connfd, const sockaddr_in &addr) {
+        // initialize the new client and put into the array.
+        users[connfd].init(connfd, addr);
+    };
 
     // Create epoll objects and event array
     epoll_event events[MAX_EVENT_NUMBER];
     int epollfd = epoll_create(5);
+    // requests of one epoll_wait batch, handed to the pool together.
+    static http_conn *ready[MAX_EVENT_NUMBER];
 
     addfd(epollfd, listenfd, false);
     http_conn::m_epollfd = epollfd;
 
+    bool accept_pending = false; // the accept budget ran out before the backlog was drained.
     while(true) {
-        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, -1);
+        // don't block while connections are left in the backlog.
+        int num = epoll_wait(epollfd, events, MAX_EVENT_NUMBER, accept_pending ? 0 : -1);
         if (num < 0 && (errno != EINTR)) {
             printf("EPOLL failure.\n");
             break;
         }
 
+        if (accept_pending) {
+            accept_pending = !accept_engine.accept_conns(init_conn);
+        }
         // traverse all the events.
+        int ready_number = 0;
         for(int i = 0; i < num; i++) {
             int sockfd = events[i].data.fd;
             if (sockfd == listenfd) {
-                struct sockaddr_in client_address;
-                socklen_t client_addrlen = sizeof(client_address);
-                int connfd = accept(listenfd, (struct sockaddr*) &client_address, &client_addrlen);
-
-                if (http_conn::m_user_count >= MAX_FD) {
-                    // full
-                    // write the client a message that the server is busy.
-                    close(connfd);
-                    continue;
-                }
-
-                // initialize the new client and put into the array.
-                users[connfd].init(connfd, client_address);
+                if (!accept_pending) accept_pending = !accept_engine.accept_conns(init_conn);
             }
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){ // disconnection from exception or error
                 users[sockfd].close_conn();
             }
+            else if (config.worker_io) {
+                // the fd stays disarmed (EPOLLONESHOT) until the worker is done with it.
+                users[sockfd].m_io_state = (events[i].events & EPOLLIN) ? http_conn::IO_READ : http_conn::IO_WRITE;
+                ready[ready_number++] = users + sockfd;
+            }
             else if (events[i].events & EPOLLIN) {
                 // read all data at one time
                 if (users[sockfd].read()) {
-                    pool->append(users + sockfd);
+                    users[sockfd].classify(); // the lane, before the request is queued.
+                    ready[ready_number++] = users + sockfd;
                 } else{
                     users[sockfd].close_conn();
                 }
@@ -120,12 +365,253 @@ int main(int argc, char* argv[]) {
 
             }
         }
+        if (ready_number > 0) {
+            // no room in the queues: answer now, the fd would never be re-armed otherwise.
+            int failed = pool->append_bulk(ready, ready_number);
+            for(int i = 0; i < failed; i++) ready[i]->reject();
+        }
     }
 
     close(epollfd);
     close(listenfd);
-    delete [] users;
     delete pool;
 
     return 0;
 }
+
+// io_uring loops, one per SO_REUSEPORT listening socket like the reuseport model.
+// Falls back to the epoll loop if the kernel can't run them.
+static int run_uring(const server_config &config, http_conn *users) {
+    if (!uring_loop::supported()) {
+        printf("io_uring is not available, falling back to epoll.\n");
+        return run_single(config, users);
+    }
+
+    std::vector<int> listenfds;
+    std::vector<uring_loop*> loops;
+    for(int i = 0; i < config.reactor_number; i++) {
+        int listenfd = open_listenfd(config.port, true, config.backlog);
+        if (listenfd < 0) {
+            printf("Failed to bind reuseport socket %d.\n", i);
+            return -1;
+        }
+        listenfds.push_back(listenfd);
+
+        int cpu = cpu_of(config, i);
+        uring_loop *loop = nullptr;
+        try {
+            loop = new uring_loop(users_for_cpu(users, cpu), MAX_FD, listenfd, cpu, config.accept_budget);
+        } catch(...) {
+            if (i == 0) {
+                close(listenfd);
+                printf("Failed to set up io_uring, falling back to epoll.\n");
+                return run_single(config, users);
+            }
+            return -1;
+        }
+        // the loops send from memory with IORING_OP_SEND, every body is mapped. Not before the
+        // first ring is there: the epoll fallback keeps -f.
+        http_conn::m_sendfile_threshold = -1;
+        printf("Creating the %d th io_uring loop...\n", i);
+        if (!loop->start()) {
+            delete loop;
+            return -1;
+        }
+        loops.push_back(loop);
+    }
+
+    for(auto loop : loops) {
+        loop->join();
+        delete loop;
+    }
+    for(auto fd : listenfds) close(fd);
+    return 0;
+}
+
+// leader/follower: -n threads take turns waiting on one epoll object and handle what they get
+// themselves, no queue and no semaphore between the event loop and the request handling.
+static int run_leader_follower(const server_config &config, http_conn *users) {
+    int listenfd = open_listenfd(config.port, false, config.backlog);
+    if (listenfd < 0) {
+        printf("Failed to bind port %d.\n", config.port);
+        return -1;
+    }
+    leader_follower *lf = nullptr;
+    try {
+        // one epoll object for all threads, the table goes to the node of the first cpu.
+        lf = new leader_follower(users_for_cpu(users, cpu_of(config, 0)), MAX_FD, listenfd,
+                                 config.reactor_number, config.accept_budget, config.cpus);
+    } catch(...) {
+        close(listenfd);
+        return -1;
+    }
+    if (!lf->start()) {
+        delete lf;
+        close(listenfd);
+        return -1;
+    }
+    lf->join();
+    delete lf;
+    close(listenfd);
+    return 0;
+}
+
+static void usage(const char *prog) {
+    printf("Run as: %s port number [-m single|reuseport|subreactor|uring|leader] [-n reactors] [-s] [-d rr|least]\n"
+           "          [-l backlog] [-b accept_budget] [-a proactor|reactor] [-t threads] [-T max_threads] [-S] [-c cpu_list]\n"
+           "          [-f sendfile_threshold] [-i inline_threshold] [-C cache_bytes] [-r doc_root]\n", prog);
+    printf("  -m  server model: single epoll loop with thread pool (default), thread-per-core reuseport,\n");
+    printf("      an acceptor handing connections to sub-reactors, io_uring loops (epoll if unavailable),\n");
+    printf("      or leader/follower threads sharing one epoll object\n");
+    printf("  -n  number of reactors in the reuseport, subreactor and uring models, of threads in the\n");
+    printf("      leader model (default: number of cpus)\n");
+    printf("  -s  steer connections to the reactor of the receiving cpu with a CBPF program\n");
+    printf("  -d  subreactor dispatch policy, round robin (default) or least loaded\n");
+    printf("  -l  listen backlog (default: %d)\n", acceptor::DEFAULT_BACKLOG);
+    printf("  -b  connections accepted per loop iteration before other events are served (default: %d)\n",
+           acceptor::DEFAULT_BUDGET);
+    printf("  -a  single model: the loop does the socket I/O and workers only parse (proactor, default),\n");
+    printf("      or workers read, parse and write themselves (reactor). Requests for large files go to\n");
+    printf("      a low priority lane; in reactor mode a request is queued before it is read, in the\n");
+    printf("      lane of the connection's previous request\n");
+    printf("  -t  thread pool workers of the single model (default: 8)\n");
+    printf("  -T  let the pool grow up to this many workers while requests wait in the queue,\n");
+    printf("      and shrink back to -t when they are idle (default: fixed size)\n");
+    printf("  -S  keep every connection on the pool worker that served it first, idle workers don't steal\n");
+    printf("  -c  pin reactors, loops and workers to these cpus in turn, e.g. 0-3,8-11; on NUMA machines\n");
+    printf("      every node also gets its own connection table\n");
+    printf("  -f  send bodies from this many bytes on with sendfile instead of mapping the file, 0 for all,\n");
+    printf("      -1 for none (default: %ld, none in the uring model)\n", http_conn::DEFAULT_SENDFILE_THRESHOLD);
+    printf("  -i  send bodies smaller than this from memory without mapping the file: a copy kept by the\n");
+    printf("      file cache, or read behind the response head, 0 for none (default: %ld)\n",
+           http_conn::DEFAULT_INLINE_THRESHOLD);
+    printf("  -C  memory for open files and their mappings shared by all threads, invalidated by inotify,\n");
+    printf("      0 for no cache (default: %ld)\n", file_cache::DEFAULT_BUDGET);
+    printf("  -r  root directory of the website\n");
+    printf("Send SIGUSR1 to print the counters.\n");
+}
+
+int main(int argc, char* argv[]) {
+
+    if (argc <= 1) {
+        usage(basename(argv[0]));
+        exit(-1);
+    }
+
+    server_config config;
+    int opt;
+    while((opt = getopt(argc, argv, "m:n:sd:l:b:a:t:T:Sc:f:i:C:r:")) != -1) {
+        switch(opt) {
+            case 'm':
+                if (strcasecmp(optarg, "single") == 0) config.model = MODEL_SINGLE;
+                else if (strcasecmp(optarg, "reuseport") == 0) config.model = MODEL_REUSEPORT;
+                else if (strcasecmp(optarg, "subreactor") == 0) config.model = MODEL_SUBREACTOR;
+                else if (strcasecmp(optarg, "uring") == 0) config.model = MODEL_URING;
+                else if (strcasecmp(optarg, "leader") == 0) config.model = MODEL_LEADER_FOLLOWER;
+                else {
+                    usage(basename(argv[0]));
+                    exit(-1);
+                }
+                break;
+            case 'n':
+                config.reactor_number = atoi(optarg);
+                break;
+            case 's':
+                config.steering = true;
+                break;
+            case 'd':
+                if (strcasecmp(optarg, "rr") == 0) config.dispatch = DISPATCH_ROUND_ROBIN;
+                else if (strcasecmp(optarg, "least") == 0) config.dispatch = DISPATCH_LEAST_LOADED;
+                else {
+                    usage(basename(argv[0]));
+                    exit(-1);
+                }
+                break;
+            case 'l':
+                config.backlog = atoi(optarg);
+                break;
+            case 'b':
+                config.accept_budget = atoi(optarg);
+                break;
+            case 'a':
+                if (strcasecmp(optarg, "proactor") == 0) config.worker_io = false;
+                else if (strcasecmp(optarg, "reactor") == 0) config.worker_io = true;
+                else {
+                    usage(basename(argv[0]));
+                    exit(-1);
+                }
+                break;
+            case 't':
+                config.thread_number = atoi(optarg);
+                break;
+            case 'T':
+                config.max_thread_number = atoi(optarg);
+                break;
+            case 'S':
+                config.sticky = true;
+                break;
+            case 'c':
+                if (!parse_cpu_list(optarg, config.cpus)) {
+                    usage(basename(argv[0]));
+                    exit(-1);
+                }
+                break;
+            case 'f':
+                config.sendfile_threshold = atol(optarg);
+                break;
+            case 'i':
+                config.inline_threshold = atol(optarg);
+                break;
+            case 'C':
+                config.cache_budget = atol(optarg);
+                break;
+            case 'r':
+                doc_root = optarg;
+                break;
+            default:
+                usage(basename(argv[0]));
+                exit(-1);
+        }
+    }
+    if (optind >= argc || config.reactor_number <= 0 || config.backlog <= 0 || config.accept_budget <= 0
+        || config.thread_number <= 0 || config.sendfile_threshold < -1
+        || config.cache_budget < 0 || config.inline_threshold < 0) {
+        usage(basename(argv[0]));
+        exit(-1);
+    }
+
+    config.port = atoi(argv[optind]);
+    http_conn::m_sendfile_threshold = config.sendfile_threshold;
+    http_conn::m_inline_threshold = config.inline_threshold;
+
+    addsig(SIGPIPE, SIG_IGN);
+    start_stats_thread();
+
+    if (config.cache_budget > 0) {
+        http_conn::m_file_cache = new file_cache(config.cache_budget, config.inline_threshold);
+        if (!http_conn::m_file_cache->start()) {
+            printf("inotify is not available, files are not cached.\n");
+            delete http_conn::m_file_cache;
+            http_conn::m_file_cache = nullptr;
+        }
+    }
+
+    http_conn *users = new http_conn[MAX_FD];
+
+    int ret;
+    if (config.model == MODEL_REUSEPORT) {
+        ret = run_reuseport(config, users);
+    } else if (config.model == MODEL_SUBREACTOR) {
+        ret = run_subreactor(config, users);
+    } else if (config.model == MODEL_LEADER_FOLLOWER) {
+        ret = run_leader_follower(config, users);
+    } else if (config.model == MODEL_URING) {
+        ret = run_uring(config, users);
+    } else {
+        ret = run_single(config, users);
+    }
+    free_node_users();
+    delete [] users;
+    delete http_conn::m_file_cache;
+    return ret;
+}
@@ -0,0 +1,189 @@
+#ifndef WEBSERVER_MPMC_QUEUE_H
+#define WEBSERVER_MPMC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <exception>
+
+/*
+ * class mpmc_queue
+ * Bounded multi-producer multi-consumer ring (Dmitry Vyukov's design). Every cell carries a
+ * sequence number telling whether it is free for the producer of a given position or holds
+ * the item for the consumer of that position, so push and pop only need one CAS on their
+ * index and no lock. The two indexes and the cells live on cache lines of their own so that
+ * producers and consumers don't invalidate each other's lines.
+ * push() fails if the queue is full, pop() if it is empty; neither ever blocks.
+ */
+template<typename T>
+class mpmc_queue {
+public:
+    explicit mpmc_queue(size_t capacity); // rounded up to a power of 2
+    ~mpmc_queue();
+
+    bool push(const T &item);
+    bool pop(T &item);
+    // claim up to count consecutive cells with a single CAS, return how many were pushed/popped.
+    size_t push_bulk(const T *items, size_t count);
+    size_t pop_bulk(T *items, size_t count);
+
+    size_t capacity() const { return m_mask + 1; }
+    // may be off while other threads push or pop.
+    size_t size_approx() const;
+
+private:
+    static const size_t CACHE_LINE = 64;
+
+    struct alignas(CACHE_LINE) cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    mpmc_queue(const mpmc_queue&) = delete;
+    mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+private:
+    // padded rather than alignas, so the queue can be a member of an object created with new.
+    char m_pad0[CACHE_LINE];
+    cell *m_buffer;
+    size_t m_mask;
+    char m_pad1[CACHE_LINE - sizeof(cell*) - sizeof(size_t)];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_pad2[CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeue_pos;
+    char m_pad3[CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+template<typename T>
+mpmc_queue<T>::mpmc_queue(size_t capacity): m_buffer(nullptr), m_mask(0), m_enqueue_pos(0), m_dequeue_pos(0) {
+    if (capacity == 0 || capacity > ((size_t) 1 << (sizeof(size_t) * 8 - 2))) {
+        throw std::exception();
+    }
+    size_t size = 1;
+    while(size < capacity) size <<= 1;
+    // operator new only guarantees the cache line alignment from C++17 on.
+    void *mem = nullptr;
+    if (posix_memalign(&mem, CACHE_LINE, size * sizeof(cell)) != 0) {
+        throw std::exception();
+    }
+    m_buffer = (cell*) mem;
+    m_mask = size - 1;
+    for(size_t i = 0; i < size; i++) {
+        new(&m_buffer[i]) cell();
+        m_buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<typename T>
+mpmc_queue<T>::~mpmc_queue() {
+    for(size_t i = 0; i <= m_mask; i++) {
+        m_buffer[i].~cell();
+    }
+    free(m_buffer);
+}
+
+template<typename T>
+bool mpmc_queue<T>::push(const T &item) {
+    cell *c;
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    while(true) {
+        c = &m_buffer[pos & m_mask];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            // the cell is free for this position, claim the position.
+            if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false; // still holds the item of the previous lap: full.
+        } else {
+            pos = m_enqueue_pos.load(std::memory_order_relaxed); // another producer was faster.
+        }
+    }
+    c->data = item;
+    c->sequence.store(pos + 1, std::memory_order_release); // publish to the consumer of pos.
+    return true;
+}
+
+template<typename T>
+bool mpmc_queue<T>::pop(T &item) {
+    cell *c;
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    while(true) {
+        c = &m_buffer[pos & m_mask];
+        size_t seq = c->sequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {
+            return false; // not written yet: empty.
+        } else {
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    item = c->data;
+    c->sequence.store(pos + m_mask + 1, std::memory_order_release); // free for the next lap.
+    return true;
+}
+
+template<typename T>
+size_t mpmc_queue<T>::push_bulk(const T *items, size_t count) {
+    size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t n;
+    while(true) {
+        // as many cells from pos on as are free for their position. Nobody else can claim them
+        // until m_enqueue_pos moves, so if the CAS succeeds they are all still free.
+        for(n = 0; n < count; n++) {
+            size_t seq = m_buffer[(pos + n) & m_mask].sequence.load(std::memory_order_acquire);
+            if (seq != pos + n) break;
+        }
+        if (n == 0) {
+            size_t seq = m_buffer[pos & m_mask].sequence.load(std::memory_order_acquire);
+            if ((intptr_t) seq - (intptr_t) pos < 0) return 0; // full
+            pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            continue;
+        }
+        if (m_enqueue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) break;
+    }
+    for(size_t i = 0; i < n; i++) {
+        cell *c = &m_buffer[(pos + i) & m_mask];
+        c->data = items[i];
+        c->sequence.store(pos + i + 1, std::memory_order_release);
+    }
+    return n;
+}
+
+template<typename T>
+size_t mpmc_queue<T>::pop_bulk(T *items, size_t count) {
+    size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+    size_t n;
+    while(true) {
+        for(n = 0; n < count; n++) {
+            size_t seq = m_buffer[(pos + n) & m_mask].sequence.load(std::memory_order_acquire);
+            if (seq != pos + n + 1) break;
+        }
+        if (n == 0) {
+            size_t seq = m_buffer[pos & m_mask].sequence.load(std::memory_order_acquire);
+            if ((intptr_t) seq - (intptr_t) (pos + 1) < 0) return 0; // empty
+            pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            continue;
+        }
+        if (m_dequeue_pos.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) break;
+    }
+    for(size_t i = 0; i < n; i++) {
+        cell *c = &m_buffer[(pos + i) & m_mask];
+        items[i] = c->data;
+        c->sequence.store(pos + i + m_mask + 1, std::memory_order_release);
+    }
+    return n;
+}
+
+template<typename T>
+size_t mpmc_queue<T>::size_approx() const {
+    size_t tail = m_enqueue_pos.load(std::memory_order_relaxed);
+    size_t head = m_dequeue_pos.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+#endif //WEBSERVER_MPMC_QUEUE_H
@@ -0,0 +1,144 @@
+#include "reactor.h"
+#include "topology.h"
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <exception>
+
+extern void addfd(int epollfd, int fd, bool one_shot);
+
+reactor::reactor(http_conn *users, int max_fd, int listenfd, int cpu, int accept_budget):
+        m_users(users), m_max_fd(max_fd), m_listenfd(listenfd), m_acceptor(nullptr),
+        m_accept_pending(false), m_cpu(cpu), m_epollfd(-1), m_wakeupfd(-1), m_thread(0),
+        m_stop(false), m_conn_count(0), m_pending_locker("reactor pending") {
+    m_epollfd = epoll_create(5);
+    if (m_epollfd < 0) {
+        throw std::exception();
+    }
+    m_wakeupfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeupfd < 0) {
+        close(m_epollfd);
+        throw std::exception();
+    }
+    addfd(m_epollfd, m_wakeupfd, false);
+    if (m_listenfd >= 0) {
+        m_acceptor = new acceptor(m_listenfd, m_max_fd, accept_budget);
+        addfd(m_epollfd, m_listenfd, false);
+    }
+}
+
+reactor::~reactor() {
+    delete m_acceptor;
+    close(m_wakeupfd);
+    close(m_epollfd);
+}
+
+bool reactor::start() {
+    if (pthread_create(&m_thread, nullptr, worker, this) != 0) {
+        return false;
+    }
+    if (m_cpu >= 0 && !pin_thread(m_thread, m_cpu)) {
+        printf("Failed to pin reactor to cpu %d.\n", m_cpu);
+    }
+    return true;
+}
+
+void reactor::join() {
+    pthread_join(m_thread, nullptr);
+}
+
+void reactor::stop() {
+    m_stop = true;
+    uint64_t one = 1;
+    ::write(m_wakeupfd, &one, sizeof one);
+}
+
+void* reactor::worker(void *arg) {
+    auto *r = (reactor*) arg;
+    r->run();
+    return r;
+}
+
+void reactor::add_conn(int connfd, const sockaddr_in &addr) {
+    pending_conn conn;
+    conn.connfd = connfd;
+    conn.address = addr;
+    m_conn_count++;
+
+    m_pending_locker.lock();
+    bool wakeup = m_pending.empty(); // an earlier add_conn() has already woken the loop up.
+    m_pending.push_back(conn);
+    m_pending_locker.unlock();
+
+    if (wakeup) {
+        uint64_t one = 1;
+        ::write(m_wakeupfd, &one, sizeof one);
+    }
+}
+
+// register the connections handed in by the acceptor on this reactor's epoll.
+void reactor::handle_wakeup() {
+    uint64_t counter;
+    ::read(m_wakeupfd, &counter, sizeof counter);
+
+    std::vector<pending_conn> pending;
+    m_pending_locker.lock();
+    pending.swap(m_pending);
+    m_pending_locker.unlock();
+
+    for(auto &conn : pending) {
+        m_users[conn.connfd].init(conn.connfd, conn.address, m_epollfd);
+    }
+}
+
+void reactor::close_conn(int sockfd) {
+    m_users[sockfd].close_conn();
+    m_conn_count--;
+}
+
+void reactor::handle_accept() {
+    // the connection lives on this reactor until it is closed.
+    m_accept_pending = !m_acceptor->accept_conns([this](int connfd, const sockaddr_in &addr) {
+        m_users[connfd].init(connfd, addr, m_epollfd);
+        m_conn_count++;
+    });
+}
+
+void reactor::run() {
+    while(!m_stop) {
+        // don't block while connections are left in the backlog.
+        int num = epoll_wait(m_epollfd, m_events, MAX_EVENT_NUMBER, m_accept_pending ? 0 : -1);
+        if (num < 0 && (errno != EINTR)) {
+            printf("EPOLL failure.\n");
+            break;
+        }
+
+        if (m_accept_pending) {
+            handle_accept();
+        }
+        for(int i = 0; i < num; i++) {
+            int sockfd = m_events[i].data.fd;
+            if (sockfd == m_listenfd) {
+                if (!m_accept_pending) handle_accept();
+            }
+            else if (sockfd == m_wakeupfd) {
+                handle_wakeup();
+            }
+            else if (m_events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                close_conn(sockfd);
+            }
+            else if (m_events[i].events & EPOLLIN) {
+                // read, parse and build the response on this thread.
+                if (!m_users[sockfd].read()) {
+                    close_conn(sockfd);
+                } else if (!m_users[sockfd].process()) {
+                    m_conn_count--; // closed by process().
+                }
+            }
+            else if (m_events[i].events & EPOLLOUT) {
+                if (!m_users[sockfd].write()) {
+                    close_conn(sockfd);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef WEBSERVER_REACTOR_H
+#define WEBSERVER_REACTOR_H
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <atomic>
+#include <vector>
+#include "http_conn.h"
+#include "locker.h"
+#include "acceptor.h"
+
+/*
+ * class reactor
+ * One event loop running on its own thread with a private epoll object.
+ * Connections registered on it are read, processed and written inline by
+ * the loop thread, so a connection never leaves the core that accepted it.
+ * If a listenfd is given (SO_REUSEPORT model), the loop also accepts on it,
+ * otherwise an acceptor hands connections in through add_conn().
+ */
+class reactor {
+public:
+    reactor(http_conn *users, int max_fd, int listenfd = -1, int cpu = -1,
+            int accept_budget = acceptor::DEFAULT_BUDGET);
+    ~reactor();
+
+    bool start(); // create the loop thread
+    void join();
+    void stop(); // from another thread: the loop returns, join() it then.
+
+    // called from the acceptor thread: queue the connection and wake the loop up.
+    void add_conn(int connfd, const sockaddr_in &addr);
+    // number of connections owned by this reactor, including those not picked up yet.
+    int load() const { return m_conn_count; }
+
+    int epollfd() const { return m_epollfd; }
+
+private:
+    struct pending_conn {
+        int connfd;
+        sockaddr_in address;
+    };
+
+    static void* worker(void *arg);
+    void run();
+    void handle_accept();
+    void handle_wakeup();
+    void close_conn(int sockfd);
+
+private:
+    static const int MAX_EVENT_NUMBER = 1024;
+
+    http_conn *m_users; // connection table shared by all reactors, indexed by fd.
+    int m_max_fd;
+    int m_listenfd; // -1 if connections are handed in from outside.
+    acceptor *m_acceptor; // nullptr if m_listenfd is -1.
+    bool m_accept_pending; // the accept budget ran out before the backlog was drained.
+    int m_cpu; // cpu to pin the loop thread to, -1 for no pinning.
+    int m_epollfd;
+    int m_wakeupfd; // eventfd, written by add_conn().
+    pthread_t m_thread;
+    std::atomic<bool> m_stop;
+    std::atomic<int> m_conn_count;
+    std::vector<pending_conn> m_pending; // connections handed in, guarded by m_pending_locker.
+    locker m_pending_locker;
+    epoll_event m_events[MAX_EVENT_NUMBER];
+};
+
+#endif //WEBSERVER_REACTOR_H
@@ -0,0 +1,16 @@
+#!/bin/sh
+# Simulated Proactor (the event loop reads and writes, workers parse) against Reactor (workers
+# also read and write) in the single model, for a small page and a large image.
+# usage: bench_actor.sh [doc_root]
+
+. "$(dirname "$0")/bench_common.sh"
+
+ROOT=${1:-$BENCH_DIR/../resources}
+
+for path in /index.html /images/image1.jpg; do
+    for mode in proactor reactor; do
+        start_server -a "$mode" -r "$ROOT"
+        echo "$mode $path: $(run_webbench "$path") pages/min"
+        stop_server
+    done
+done
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Keep-alive throughput of the single model with sticky connections (-S) against work stealing
+# (the default), and the cache misses of the server process if perf is installed.
+# usage: bench_affinity.sh [threads] [doc_root]
+#   KEEPALIVE  keepalive_bench binary (default: ../cmake-build-debug/keepalive_bench)
+
+. "$(dirname "$0")/bench_common.sh"
+
+THREADS=${1:-$(nproc)}
+ROOT=${2:-$BENCH_DIR/../resources}
+KEEPALIVE=${KEEPALIVE:-$BENCH_DIR/../cmake-build-debug/keepalive_bench}
+
+for mode in stealing sticky; do
+    for io in proactor reactor; do
+        if [ "$mode" = sticky ]; then
+            start_server -t "$THREADS" -a "$io" -S -r "$ROOT"
+        else
+            start_server -t "$THREADS" -a "$io" -r "$ROOT"
+        fi
+        if command -v perf > /dev/null 2>&1; then
+            perf stat -e cache-references,cache-misses,LLC-load-misses -p "$SERVER_PID" \
+                -o /tmp/bench_affinity.perf sleep "$DURATION" &
+            PERF_PID=$!
+        fi
+        echo "$mode $io: $("$KEEPALIVE" "$PORT" /index.html "$CLIENTS" "$DURATION")"
+        if [ -n "$PERF_PID" ]; then
+            wait "$PERF_PID"
+            grep -E "cache|LLC" /tmp/bench_affinity.perf
+            PERF_PID=
+        fi
+        stop_server
+    done
+done
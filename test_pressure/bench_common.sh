@@ -0,0 +1,37 @@
+#!/bin/sh
+# Helpers shared by the bench_*.sh scripts. Source it, do not run it.
+#   SERVER    webserver binary (default: ../cmake-build-debug/webserver)
+#   WEBBENCH  webbench binary (default: webbench-1.5/webbench)
+#   CLIENTS   concurrent webbench clients (default: 1000)
+#   DURATION  seconds per run (default: 10)
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+SERVER=${SERVER:-$BENCH_DIR/../cmake-build-debug/webserver}
+WEBBENCH=${WEBBENCH:-$BENCH_DIR/webbench-1.5/webbench}
+CLIENTS=${CLIENTS:-1000}
+DURATION=${DURATION:-10}
+PORT=${PORT:-10000}
+SERVER_PID=
+
+# start_server <args...>: start the webserver on $PORT in the background.
+start_server() {
+    "$SERVER" "$PORT" "$@" > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 1
+}
+
+stop_server() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2> /dev/null
+        wait "$SERVER_PID" 2> /dev/null
+        SERVER_PID=
+    fi
+}
+
+# run_webbench <path>: print pages/min of one webbench run against the running server.
+run_webbench() {
+    "$WEBBENCH" -2 -c "$CLIENTS" -t "$DURATION" "http://127.0.0.1:$PORT$1" 2> /dev/null \
+        | sed -n 's/^Speed=\([0-9]*\) pages\/min.*/\1/p'
+}
+
+trap stop_server EXIT INT TERM
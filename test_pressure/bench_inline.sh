@@ -0,0 +1,35 @@
+#!/bin/sh
+# Request latency of small files by body path: mapped per request (-f -1), sendfile (-f 0), read
+# behind the head (-i), and with the file cache: sendfile from its fd (-i 0) and its copy (-i),
+# for 1 to 64 KB files in a scratch document root. Bodies that don't fit the write buffer are
+# never read behind the head, they take sendfile.
+# usage: bench_inline.sh [threads] [scratch_dir]
+#   KEEPALIVE  keepalive_bench binary (default: ../cmake-build-debug/keepalive_bench)
+#   CONNS      keep-alive connections (default: 10)
+
+. "$(dirname "$0")/bench_common.sh"
+
+THREADS=${1:-$(nproc)}
+ROOT=${2:-/tmp/bench_inline}
+KEEPALIVE=${KEEPALIVE:-$BENCH_DIR/../cmake-build-debug/keepalive_bench}
+CONNS=${CONNS:-10}
+
+mkdir -p "$ROOT"
+for kb in 1 4 16 64; do
+    [ -f "$ROOT/$kb.bin" ] || head -c $((kb * 1024)) /dev/urandom > "$ROOT/$kb.bin"
+done
+chmod o+r "$ROOT"/*.bin
+
+for kb in 1 4 16 64; do
+    for path in mmap sendfile read cached-fd cached-copy; do
+        case $path in
+            mmap)     start_server -t "$THREADS" -C 0 -f -1 -i 0 -r "$ROOT" ;;
+            sendfile) start_server -t "$THREADS" -C 0 -f 0 -i 0 -r "$ROOT" ;;
+            read)     start_server -t "$THREADS" -C 0 -i 65537 -r "$ROOT" ;;
+            cached-fd)   start_server -t "$THREADS" -f 0 -i 0 -r "$ROOT" ;;
+            cached-copy) start_server -t "$THREADS" -i 65537 -r "$ROOT" ;;
+        esac
+        echo "$kb KB $path: $("$KEEPALIVE" "$PORT" "/$kb.bin" "$CONNS" "$DURATION")"
+        stop_server
+    done
+done
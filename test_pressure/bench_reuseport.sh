@@ -0,0 +1,26 @@
+#!/bin/sh
+# Throughput of the thread-per-core reuseport model with 1..N reactors, against the single
+# epoll loop with the thread pool. Scaling should be close to linear up to the number of cores.
+# usage: bench_reuseport.sh [max_reactors] [doc_root]
+
+. "$(dirname "$0")/bench_common.sh"
+
+MAX=${1:-$(nproc)}
+ROOT=${2:-$BENCH_DIR/../resources}
+
+start_server -r "$ROOT"
+echo "single     : $(run_webbench /index.html) pages/min"
+stop_server
+
+n=1
+while [ "$n" -le "$MAX" ]; do
+    start_server -m reuseport -n "$n" -r "$ROOT"
+    echo "reuseport $n: $(run_webbench /index.html) pages/min"
+    stop_server
+    if [ "$n" -eq "$(nproc)" ]; then
+        start_server -m reuseport -n "$n" -s -r "$ROOT"
+        echo "steering  $n: $(run_webbench /index.html) pages/min"
+        stop_server
+    fi
+    n=$((n + 1))
+done
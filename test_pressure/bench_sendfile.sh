@@ -0,0 +1,40 @@
+#!/bin/sh
+# Keep-alive throughput of file bodies mapped per request (-f -1) against sendfile (-f 0), for
+# 4 KB, 1 MB and 1 GB files in a scratch document root. Both run without the file cache and
+# inline bodies (-C 0 -i 0), which would take these files off either path.
+# usage: bench_sendfile.sh [threads] [scratch_dir]
+#   KEEPALIVE  keepalive_bench binary (default: ../cmake-build-debug/keepalive_bench)
+
+. "$(dirname "$0")/bench_common.sh"
+
+THREADS=${1:-$(nproc)}
+ROOT=${2:-/tmp/bench_sendfile}
+KEEPALIVE=${KEEPALIVE:-$BENCH_DIR/../cmake-build-debug/keepalive_bench}
+
+mkdir -p "$ROOT"
+[ -f "$ROOT/4k.bin" ] || head -c 4096 /dev/urandom > "$ROOT/4k.bin"
+[ -f "$ROOT/1m.bin" ] || head -c 1048576 /dev/urandom > "$ROOT/1m.bin"
+[ -f "$ROOT/1g.bin" ] || dd if=/dev/urandom of="$ROOT/1g.bin" bs=1M count=1024 2> /dev/null
+chmod o+r "$ROOT"/*.bin
+cat "$ROOT"/*.bin > /dev/null # into the page cache, both paths read from there.
+
+for file in 4k 1m 1g; do
+    size=$(wc -c < "$ROOT/$file.bin")
+    # fewer connections for larger files, one response of 1 GB takes a while already.
+    case $file in
+        4k) conns=100 ;;
+        1m) conns=20 ;;
+        *)  conns=2 ;;
+    esac
+    for path in mmap sendfile; do
+        if [ "$path" = mmap ]; then
+            start_server -t "$THREADS" -C 0 -i 0 -f -1 -r "$ROOT"
+        else
+            start_server -t "$THREADS" -C 0 -i 0 -f 0 -r "$ROOT"
+        fi
+        result=$("$KEEPALIVE" "$PORT" "/$file.bin" "$conns" "$DURATION")
+        echo "$file $path: $result, $(echo "$result" | awk -v size="$size" \
+            '{ sub("s:", "", $4); printf "%.0f", $1 * size / $4 / 1048576 }') MB/s"
+        stop_server
+    done
+done
@@ -0,0 +1,177 @@
+// Keep-alive load generator: every connection sends a request, reads the whole response
+// (Content-Length) and sends the next one on the same connection, for a number of seconds.
+// webbench opens a connection per request, this one measures the keep-alive path.
+// With a pipeline depth > 1 a connection sends that many requests in one segment and the next
+// batch once all of their responses are in. The latency printed is from sending a batch to its
+// last response.
+// Run as: keepalive_bench port path [connections] [seconds] [depth]
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+struct client {
+    int fd;
+    char buf[4096];
+    int len;          // bytes of the response head in buf
+    long body_left;   // -1 while the head is incomplete
+    int outstanding;  // requests sent and not answered yet
+    double sent_at;   // of the batch
+};
+
+static sockaddr_in server_addr;
+static char request[65536]; // depth requests
+static int request_len;
+static int depth = 1;
+static std::vector<double> latencies; // of the batches, in seconds
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static bool send_batch(client &c) {
+    c.outstanding = depth;
+    c.sent_at = now();
+    return send(c.fd, request, request_len, 0) == request_len;
+}
+
+// connect and send the first request, false if the server is not there.
+static bool open_client(client &c, int epollfd) {
+    c.fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c.fd < 0 || connect(c.fd, (sockaddr*) &server_addr, sizeof server_addr) != 0) {
+        if (c.fd >= 0) close(c.fd);
+        return false;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    fcntl(c.fd, F_SETFL, fcntl(c.fd, F_GETFL) | O_NONBLOCK);
+    c.len = 0;
+    c.body_left = -1;
+    epoll_event event;
+    event.data.ptr = &c;
+    event.events = EPOLLIN;
+    epoll_ctl(epollfd, EPOLL_CTL_ADD, c.fd, &event);
+    return send_batch(c);
+}
+
+// consume what arrived, 1 per complete response, -1 if the connection is gone.
+static int on_readable(client &c) {
+    int done = 0;
+    while(true) {
+        char data[65536];
+        ssize_t n = recv(c.fd, data, sizeof data, 0);
+        if (n == 0) return -1;
+        if (n < 0) return errno == EAGAIN ? done : -1;
+        char *p = data, *end = data + n;
+        while(p < end) {
+            if (c.body_left < 0) {
+                // copy head bytes until the blank line.
+                while(p < end && c.body_left < 0) {
+                    if (c.len == (int) sizeof c.buf - 1) return -1;
+                    c.buf[c.len++] = *p++;
+                    if (c.len >= 4 && memcmp(c.buf + c.len - 4, "\r\n\r\n", 4) == 0) {
+                        c.buf[c.len] = '\0';
+                        const char *cl = strcasestr(c.buf, "Content-Length:");
+                        c.body_left = cl ? atol(cl + 15) : 0;
+                    }
+                }
+            }
+            if (c.body_left >= 0) {
+                long take = end - p < c.body_left ? end - p : c.body_left;
+                p += take;
+                c.body_left -= take;
+                if (c.body_left == 0) {
+                    done++;
+                    c.len = 0;
+                    c.body_left = -1;
+                    if (--c.outstanding == 0) {
+                        latencies.push_back(now() - c.sent_at);
+                        if (!send_batch(c)) return -1;
+                    }
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printf("usage: %s port path [connections] [seconds] [depth]\n", argv[0]);
+        return 1;
+    }
+    int connections = argc > 3 ? atoi(argv[3]) : 100;
+    int seconds = argc > 4 ? atoi(argv[4]) : 10;
+    depth = argc > 5 ? atoi(argv[5]) : 1;
+    if (connections <= 0 || seconds <= 0 || depth <= 0 || depth > 64) {
+        printf("usage: %s port path [connections] [seconds] [depth]\n", argv[0]);
+        return 1;
+    }
+    memset(&server_addr, 0, sizeof server_addr);
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(atoi(argv[1]));
+    inet_pton(AF_INET, "127.0.0.1", &server_addr.sin_addr);
+    for(int i = 0; i < depth; i++) {
+        int len = snprintf(request + request_len, sizeof request - request_len,
+                           "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: keep-alive\r\n\r\n", argv[2]);
+        if (len >= (int) sizeof request - request_len) {
+            printf("Path too long.\n");
+            return 1;
+        }
+        request_len += len;
+    }
+
+    int epollfd = epoll_create(5);
+    std::vector<client> clients(connections);
+    for(auto &c : clients) {
+        if (!open_client(c, epollfd)) {
+            printf("Cannot connect to port %s.\n", argv[1]);
+            return 1;
+        }
+    }
+
+    long responses = 0, reconnects = 0;
+    double start = now(), stop = start + seconds;
+    epoll_event events[1024];
+    while(now() < stop) {
+        int num = epoll_wait(epollfd, events, 1024, 100);
+        for(int i = 0; i < num; i++) {
+            client &c = *(client*) events[i].data.ptr;
+            int done = on_readable(c);
+            if (done < 0) {
+                // the server closed the connection (not keep-alive, or shed): start over.
+                close(c.fd);
+                reconnects++;
+                if (!open_client(c, epollfd)) reconnects++;
+            } else {
+                responses += done;
+            }
+        }
+    }
+    double elapsed = now() - start;
+    printf("%ld responses in %.1fs: %.0f requests/s, %ld reconnects", responses, elapsed, responses / elapsed,
+           reconnects);
+    if (!latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        double sum = 0;
+        for(double l : latencies) sum += l;
+        printf(", latency avg %.3f p50 %.3f p99 %.3f ms", sum / latencies.size() * 1e3,
+               latencies[latencies.size() / 2] * 1e3, latencies[latencies.size() * 99 / 100] * 1e3);
+    }
+    printf("\n");
+    for(auto &c : clients) close(c.fd);
+    close(epollfd);
+    return 0;
+}
@@ -0,0 +1,119 @@
+// Contention on locker and sem: the pthread/POSIX wrappers against the futex based ones with
+// adaptive spinning (see locker.h), whichever of them the server is built with.
+// mutex: every thread locks, bumps a shared counter and unlocks, in a loop.
+// sem:   half of the threads post, the other half waits (one thread does both).
+// Run as: lock_bench [max_threads] [ops]
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../locker.h"
+
+template<typename L>
+struct mutex_arg {
+    L *lock;
+    long ops;
+    long counter;
+};
+
+template<typename L>
+static void* mutex_worker(void *arg) {
+    auto *a = (mutex_arg<L>*) arg;
+    for(long i = 0; i < a->ops; i++) {
+        a->lock->lock();
+        a->counter++;
+        a->lock->unlock();
+    }
+    return nullptr;
+}
+
+template<typename S>
+struct sem_arg {
+    S *sem;
+    long ops;
+};
+
+template<typename S>
+static void* sem_poster(void *arg) {
+    auto *a = (sem_arg<S>*) arg;
+    for(long i = 0; i < a->ops; i++) a->sem->post();
+    return nullptr;
+}
+
+template<typename S>
+static void* sem_waiter(void *arg) {
+    auto *a = (sem_arg<S>*) arg;
+    for(long i = 0; i < a->ops; i++) a->sem->wait();
+    return nullptr;
+}
+
+template<typename S>
+static void* sem_both(void *arg) {
+    auto *a = (sem_arg<S>*) arg;
+    for(long i = 0; i < a->ops; i++) {
+        a->sem->post();
+        a->sem->wait();
+    }
+    return nullptr;
+}
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// lock/unlock pairs per second with thread_number threads sharing one lock.
+template<typename L>
+static double run_mutex(int thread_number, long total_ops) {
+    L lock;
+    std::vector<pthread_t> threads(thread_number);
+    mutex_arg<L> arg = { &lock, total_ops / thread_number, 0 };
+    double start = now();
+    for(int i = 0; i < thread_number; i++) {
+        pthread_create(&threads[i], nullptr, mutex_worker<L>, &arg);
+    }
+    for(int i = 0; i < thread_number; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    double elapsed = now() - start;
+    if (arg.counter != arg.ops * thread_number) printf("lost updates: %ld\n", arg.ops * thread_number - arg.counter);
+    return arg.ops * thread_number / elapsed;
+}
+
+// waits per second with thread_number threads sharing one semaphore.
+template<typename S>
+static double run_sem(int thread_number, long total_ops) {
+    S sem;
+    std::vector<pthread_t> threads(thread_number);
+    int pairs = thread_number / 2;
+    sem_arg<S> arg = { &sem, pairs ? total_ops / pairs : total_ops };
+    double start = now();
+    for(int i = 0; i < thread_number; i++) {
+        void* (*fn)(void*) = pairs == 0 ? sem_both<S> : (i % 2 ? sem_waiter<S> : sem_poster<S>);
+        pthread_create(&threads[i], nullptr, fn, &arg);
+    }
+    for(int i = 0; i < thread_number; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    return arg.ops * (pairs ? pairs : 1) / (now() - start);
+}
+
+int main(int argc, char* argv[]) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 64;
+    long ops = argc > 2 ? atol(argv[2]) : 2000000;
+    if (max_threads <= 0 || ops <= 0) {
+        printf("usage: %s [max_threads] [ops]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%8s %16s %16s %16s %16s\n", "threads", "pthread lock/s", "futex lock/s", "posix sem/s", "futex sem/s");
+    for(int n = 1; n <= max_threads; n *= 2) {
+        printf("%8d %16.0f %16.0f %16.0f %16.0f\n", n,
+               run_mutex<pthread_locker>(n, ops), run_mutex<futex_locker>(n, ops),
+               run_sem<pthread_sem>(n, ops), run_sem<futex_sem>(n, ops));
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Line splitting of typical browser request heads with the scalar, SSE2 and AVX2 versions of
+// find_line_end() (see crlf_scan.h), the way http_conn::parse_line() uses it: find the
+// terminator, skip "\r\n", repeat. Run as: parse_bench [rounds]
+
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "../crlf_scan.h"
+
+static const char *requests[] = {
+    // Chrome
+    "GET /images/image1.jpg HTTP/1.1\r\n"
+    "Host: 192.168.1.10:10000\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: http://192.168.1.10:10000/index.html\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7\r\n"
+    "Cookie: session=8f2a61c3e4b94d0f9a7c2e51b6d3f0a4; theme=dark; _ga=GA1.1.1234567890.1700000000\r\n"
+    "\r\n",
+    // Firefox
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 192.168.1.10:10000\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Ubuntu; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "If-Modified-Since: Thu, 04 Aug 2022 08:12:45 GMT\r\n"
+    "If-None-Match: \"62eb7f4d-1f4\"\r\n"
+    "Priority: u=1\r\n"
+    "\r\n",
+    // curl
+    "GET / HTTP/1.1\r\n"
+    "Host: localhost:10000\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+};
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// lines found, so the work can't be optimized away.
+static long split(line_end_finder find, const std::string &heads, long rounds) {
+    long lines = 0;
+    const char *end = heads.data() + heads.size();
+    for(long r = 0; r < rounds; r++) {
+        const char *p = heads.data();
+        while(p < end) {
+            p = find(p, end);
+            if (p == end) break;
+            p += (*p == '\r') ? 2 : 1;
+            lines++;
+        }
+    }
+    return lines;
+}
+
+int main(int argc, char* argv[]) {
+    long rounds = argc > 1 ? atol(argv[1]) : 200000;
+    if (rounds <= 0) {
+        printf("usage: %s [rounds]\n", argv[0]);
+        return 1;
+    }
+    std::string heads;
+    for(auto request : requests) heads += request;
+
+    struct { const char *name; line_end_finder find; } variants[] = {
+        { "scalar", find_line_end_scalar },
+        { "sse2", find_line_end_sse2 },
+        { "avx2", find_line_end_avx2 },
+        { "dispatched", find_line_end_impl },
+    };
+    long expected = split(find_line_end_scalar, heads, 1);
+    printf("%d request heads, %zu bytes, %ld lines\n", (int) (sizeof requests / sizeof requests[0]),
+           heads.size(), expected);
+    printf("%12s %14s %10s\n", "variant", "lines/s", "MB/s");
+    for(auto &v : variants) {
+        if (!v.find) {
+            printf("%12s %14s %10s\n", v.name, "-", "-");
+            continue;
+        }
+        double start = now();
+        long lines = split(v.find, heads, rounds);
+        double elapsed = now() - start;
+        if (lines != expected * rounds) printf("%s: wrong line count %ld\n", v.name, lines);
+        printf("%12s %14.0f %10.0f\n", v.name, lines / elapsed, heads.size() * rounds / elapsed / 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Throughput of the thread pool work queue: the lock-free mpmc_queue against the std::list
+// guarded by a mutex and a semaphore that threadpool used before.
+// Every thread pushes an item and pops one, in a loop. Run as: queue_bench [max_threads] [ops]
+
+#include <pthread.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <vector>
+#include "../locker.h"
+#include "../mpmc_queue.h"
+
+// the former threadpool queue.
+class list_queue {
+public:
+    bool push(int *item) {
+        m_queuelocker.lock();
+        m_workqueue.push_back(item);
+        m_queuelocker.unlock();
+        m_queuestat.post();
+        return true;
+    }
+    bool pop(int *&item) {
+        m_queuestat.wait();
+        m_queuelocker.lock();
+        item = m_workqueue.front();
+        m_workqueue.pop_front();
+        m_queuelocker.unlock();
+        return true;
+    }
+
+private:
+    std::list<int*> m_workqueue;
+    pthread_locker m_queuelocker;
+    pthread_sem m_queuestat;
+};
+
+// mpmc_queue with the parking used by threadpool.
+class ring_queue {
+public:
+    explicit ring_queue(size_t capacity): m_queue(capacity) {}
+    bool push(int *item) {
+        while(!m_queue.push(item)) {}
+        m_idle.notify_one();
+        return true;
+    }
+    bool pop(int *&item) {
+        while(!m_queue.pop(item)) {
+            unsigned key = m_idle.prepare_wait();
+            if (m_queue.pop(item)) {
+                m_idle.cancel_wait();
+                break;
+            }
+            m_idle.wait(key);
+        }
+        return true;
+    }
+
+private:
+    mpmc_queue<int*> m_queue;
+    event_count m_idle;
+};
+
+template<typename Q>
+struct bench_arg {
+    Q *queue;
+    long ops;
+};
+
+template<typename Q>
+static void* bench_worker(void *arg) {
+    auto *a = (bench_arg<Q>*) arg;
+    static int item;
+    int *out;
+    for(long i = 0; i < a->ops; i++) {
+        a->queue->push(&item);
+        a->queue->pop(out);
+    }
+    return nullptr;
+}
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// push+pop pairs per second with thread_number threads sharing one queue.
+template<typename Q>
+static double run(Q *queue, int thread_number, long total_ops) {
+    std::vector<pthread_t> threads(thread_number);
+    bench_arg<Q> arg = { queue, total_ops / thread_number };
+    double start = now();
+    for(int i = 0; i < thread_number; i++) {
+        pthread_create(&threads[i], nullptr, bench_worker<Q>, &arg);
+    }
+    for(int i = 0; i < thread_number; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    return 2.0 * arg.ops * thread_number / (now() - start);
+}
+
+int main(int argc, char* argv[]) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 64;
+    long ops = argc > 2 ? atol(argv[2]) : 2000000;
+    if (max_threads <= 0 || ops <= 0) {
+        printf("usage: %s [max_threads] [ops]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%8s %16s %16s\n", "threads", "list+mutex op/s", "mpmc op/s");
+    for(int n = 1; n <= max_threads; n *= 2) {
+        list_queue list;
+        ring_queue ring(10000);
+        double list_ops = run(&list, n, ops);
+        double ring_ops = run(&ring, n, ops);
+        printf("%8d %16.0f %16.0f\n", n, list_ops, ring_ops);
+    }
+    return 0;
+}
@@ -6,102 +6,565 @@
 #define WEBSERVER_THREADPOOL_H
 
 #include <pthread.h>
-#include <list>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <ctime>
 #include "locker.h"
+#include "mpmc_queue.h"
+#include "topology.h"
 #include <cstdio>
 
 // thread pool class.
+// In the default (simulated Proactor) mode the event loop does the socket I/O and a worker only
+// runs process(). With worker_io (Reactor mode) the loop just reports readiness and the worker
+// reads, processes or writes according to the request's m_io_state.
+//
+// Every worker has a queue of its own. append() puts a request on the queue of the worker that
+// served it last (T::m_last_worker), so the connection's state is likely still in that core's
+// cache; a worker with nothing to do steals from the others, starting at a random one.
+//
+// The pool runs between thread_number and max_thread_number workers. A manager thread looks at
+// the time requests waited in the queues and at the time workers slept: it adds workers while
+// requests wait too long and retires one once the others would still sleep most of the time
+// without it, SHRINK_IDLE_INTERVALS checks in a row. After every step it waits COOLDOWN_INTERVALS checks for the step to show, so
+// a steady load doesn't keep creating and joining threads.
+//
+// Admission control (CoDel as used for request queues): every worker tracks the shortest queue
+// wait it saw in each 100ms interval. If even the shortest one was above the 5ms target, the
+// queue is standing rather than absorbing a burst, and until that changes requests that waited
+// more than twice the target are answered with T::reject() (a 503) instead of being served late.
+// A request append() has no room for is left to the caller, which should reject it too.
+//
+// Priority lanes: T::m_priority picks the high lane (cheap requests, e.g. error responses and
+// small files) or the low one (large files, requests with a body). Workers take from the high
+// lanes first, their own and then the others', and every LOW_LANE_SHARE-th time from the low
+// lanes first, so a few clients downloading big files don't hold up the cheap requests behind
+// them and still don't starve.
+//
+// append_bulk() queues all requests of an event loop iteration at once: one CAS per worker queue
+// and lane instead of one per request, and wakeups only for as many sleeping workers as there are
+// batches of POP_BATCH requests. A worker takes up to POP_BATCH requests from its own queue at a time.
+//
+// sticky: a connection stays with the worker that served it first. Workers don't steal from each
+// other, so its buffers and parser state stay in one core's cache for the whole keep-alive
+// session, at the price of load balance. A request only moves when its worker is retired or its
+// queue is full.
 template<typename T>
 class threadpool {
 public:
-    threadpool(int thread_number = 8, int max_requests = 10000);
+    // worker i is pinned to cpus[i % cpus.size()], no pinning if cpus is empty.
+    // max_thread_number <= thread_number gives a pool of fixed size.
+    threadpool(int thread_number = 8, int max_requests = 10000, bool worker_io = false,
+               const std::vector<int> &cpus = std::vector<int>(), int max_thread_number = 0,
+               bool sticky = false);
     ~threadpool();
     bool append(T* request);
+    bool append(T* request, typename T::IO_STATE state); // reactor mode
+    // returns the number of requests that found no room, they are moved to the front of requests.
+    int append_bulk(T** requests, int count);
+
+    int thread_count() const { return m_active; }
+
+    static void print_stats();
+
+public:
+    static std::atomic<unsigned long> m_shed_late; // rejected by CoDel.
+    static std::atomic<unsigned long> m_shed_full; // append() failed, the queues were full.
 
 private:
-    int m_thread_number;
-    pthread_t *m_threads; //threads
+    static const int MANAGE_INTERVAL_MS = 100;
+    static const uint64_t GROW_WAIT_NS = 1000000; // mean queue wait that adds workers, 1ms.
+    // share of the time the other workers would sleep without one that retires it, in this many
+    // checks in a row.
+    static const int SHRINK_IDLE_PERCENT = 50;
+    static const int SHRINK_IDLE_INTERVALS = 10;
+    static const int COOLDOWN_INTERVALS = 5; // checks without a step after every step.
+    static const uint64_t CODEL_TARGET_NS = 5000000; // acceptable standing queue wait, 5ms.
+    static const uint64_t CODEL_INTERVAL_NS = 100000000; // 100ms
+    static const int LANES = 2; // indexed by T::PRIORITY, 0 is served first.
+    static const unsigned LOW_LANE_SHARE = 8; // the low lanes go first on every 8th dequeue.
+    static const int POP_BATCH = 4; // requests a worker takes from its own queue at once.
+
+    struct task {
+        T* request;
+        uint64_t enqueue_ns;
+    };
+
+    struct worker_queue {
+        explicit worker_queue(size_t capacity): high(capacity), low(capacity) {}
+        mpmc_queue<task>& lane(int priority) { return priority == 0 ? high : low; }
+        mpmc_queue<task> high; // pushed by the event loop, popped by the owner and by thieves.
+        mpmc_queue<task> low;
+        unsigned dequeues; // owner only, for the share of the low lane.
+        event_count idle; // the owner sleeps here while there is nothing to do.
+        threadpool *pool;
+        int index;
+        pthread_t thread;
+        bool running; // created and not joined yet, only touched by the constructor and the manager.
+        // written by the owner only, read by the manager.
+        std::atomic<uint64_t> wait_ns; // sum of the queue waits of the requests it took.
+        std::atomic<uint64_t> waits;
+        std::atomic<uint64_t> idle_ns; // time asleep, not counting the current sleep.
+        std::atomic<uint64_t> parked_since; // start of the current sleep, 0 while awake.
+        // the manager's readings at the last check.
+        uint64_t last_wait_ns, last_waits, last_idle_ns;
+        // CoDel state of the worker, for whatever it dequeues.
+        uint64_t codel_interval_end;
+        uint64_t codel_min_wait;
+        bool codel_overloaded;
+    };
+
+    int m_thread_number; // minimum
+    int m_max_thread_number;
     int m_max_requests;
-    std::list<T*> m_workqueue;//work queue
-    locker m_queuelocker; //mutex
-    sem m_queuestat; //semaphore
-    bool m_stop; // stop the pool
+    bool m_worker_io; // workers do the socket I/O themselves.
+    bool m_sticky; // no stealing between running workers.
+    std::vector<int> m_cpus;
+    worker_queue **m_workqueues; // work queues, one per worker up to the maximum, lock-free.
+    std::atomic<int> m_active; // workers [0, m_active) run, the others are retired.
+    std::atomic<int> m_parked; // # of sleeping workers.
+    std::atomic<unsigned> m_next_target; // for requests no worker has served yet.
+    std::atomic<bool> m_stop; // stop the pool
+    pthread_t m_manager;
+    bool m_manager_running;
+    int m_idle_intervals; // checks in a row with most of the time asleep, manager only.
+    int m_cooldown; // checks left before the next step, manager only.
+    pthread_locker m_manager_locker; // pthread, for the cond.
+    cond m_manager_cond; // wakes the manager up for the stop.
 
+    static uint64_t now_ns();
     static void* worker(void *arg);
-    void run();
+    static void* manager(void *arg);
+    void run(worker_queue *own);
+    void handle(T* request, int self);
+    bool steal(int self, unsigned &seed, int lane, task &item);
+    int take(worker_queue *own, unsigned &seed, task *items);
+    bool push_task(const task &item, int target, int lane, int active);
+    bool codel_shed(worker_queue *own, uint64_t now, uint64_t wait);
+    void wakeup(int target, int count = 1);
+    bool start_worker(int index);
+    void manage();
+    void adjust();
+    void stop();
 
 };
 
 template<typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests):
-        m_thread_number(thread_number), m_max_requests(max_requests),
-        m_stop(false), m_threads(nullptr) {
+threadpool<T>::threadpool(int thread_number, int max_requests, bool worker_io, const std::vector<int> &cpus,
+                          int max_thread_number, bool sticky):
+        m_thread_number(thread_number),
+        m_max_thread_number(max_thread_number > thread_number ? max_thread_number : thread_number),
+        m_max_requests(max_requests), m_worker_io(worker_io), m_sticky(sticky), m_cpus(cpus), m_workqueues(nullptr),
+        m_active(0), m_parked(0), m_next_target(0), m_stop(false), m_manager(0), m_manager_running(false),
+        m_idle_intervals(0), m_cooldown(0) {
     if (thread_number <= 0 || max_requests <= 0) {
         throw std::exception();
     }
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads){
-        throw std::exception();
+    // the limit is shared out, a full queue spills over to the next one.
+    int capacity = max_requests / thread_number > 0 ? max_requests / thread_number : 1;
+    m_workqueues = new worker_queue*[m_max_thread_number];
+    for(int i = 0; i < m_max_thread_number; i++) {
+        worker_queue *wq = new worker_queue(capacity);
+        wq->pool = this;
+        wq->index = i;
+        wq->thread = 0;
+        wq->running = false;
+        wq->dequeues = 0;
+        wq->wait_ns = 0;
+        wq->waits = 0;
+        wq->idle_ns = 0;
+        wq->parked_since = 0;
+        wq->last_wait_ns = wq->last_waits = wq->last_idle_ns = 0;
+        wq->codel_interval_end = 0;
+        wq->codel_min_wait = 0;
+        wq->codel_overloaded = false;
+        m_workqueues[i] = wq;
     }
 
-    // detach, destroyed by itself.
+    // joinable, stopped and joined by the destructor or the manager.
     for(int i = 0; i < m_thread_number; i++){
-        printf("Creating the %d th thread...\n", i);
-        if (pthread_create(m_threads + i, nullptr, worker, this) != 0) {
-            delete [] m_threads;
+        if (!start_worker(i)) {
+            stop();
             throw std::exception();
         }
-        if (pthread_detach(m_threads[i])) {
-            delete [] m_threads;
+    }
+    if (m_max_thread_number > m_thread_number) {
+        if (pthread_create(&m_manager, nullptr, manager, this) != 0) {
+            stop();
             throw std::exception();
         }
+        m_manager_running = true;
     }
 }
 
 template<typename T>
 threadpool<T>::~threadpool(){
-    delete [] m_threads;
+    stop();
+}
+
+// wake everybody up, wait for them and free the queues. Requests still queued are dropped.
+template<typename T>
+void threadpool<T>::stop(){
+    m_manager_locker.lock();
     m_stop = true;
+    m_manager_cond.signal();
+    m_manager_locker.unlock();
+    if (m_manager_running) {
+        pthread_join(m_manager, nullptr);
+        m_manager_running = false;
+    }
+
+    for(int i = 0; i < m_max_thread_number; i++) {
+        m_workqueues[i]->idle.notify_all();
+    }
+    for(int i = 0; i < m_max_thread_number; i++) {
+        if (m_workqueues[i]->running) {
+            pthread_join(m_workqueues[i]->thread, nullptr);
+            m_workqueues[i]->running = false;
+        }
+    }
+    for(int i = 0; i < m_max_thread_number; i++) {
+        delete m_workqueues[i];
+    }
+    delete [] m_workqueues;
+    m_workqueues = nullptr;
 }
 
 template<typename T>
-bool threadpool<T>::append(T* request){
-    m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_requests) { // # of workers exceed the limit, return false.
-        m_queuelocker.unlock();
+uint64_t threadpool<T>::now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// make worker index run. Workers are only added at the end: index == m_active.
+template<typename T>
+bool threadpool<T>::start_worker(int index){
+    worker_queue *wq = m_workqueues[index];
+    m_active = index + 1; // before the thread starts, it leaves as soon as it sees itself retired.
+    printf("Creating the %d th thread...\n", index);
+    if (pthread_create(&wq->thread, nullptr, worker, wq) != 0) {
+        m_active = index;
         return false;
     }
-
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
+    wq->running = true;
+    if (!m_cpus.empty() && !pin_thread(wq->thread, m_cpus[index % m_cpus.size()])) {
+        printf("Failed to pin worker %d to cpu %d.\n", index, m_cpus[index % m_cpus.size()]);
+    }
     return true;
 }
 
+template<typename T>
+bool threadpool<T>::append(T* request){
+    task item;
+    item.request = request;
+    item.enqueue_ns = now_ns();
+    int active = m_active.load(std::memory_order_relaxed);
+    int target = request->m_last_worker;
+    if (target < 0 || target >= active) {
+        target = (int) (m_next_target++ % active);
+    }
+    if (push_task(item, target, request->m_priority == 0 ? 0 : 1, active)) return true;
+    m_shed_full++;
+    return false; // # of requests exceed the limit, return false.
+}
+
+// queue item at target, or at the next worker with room.
+template<typename T>
+bool threadpool<T>::push_task(const task &item, int target, int lane, int active){
+    for(int i = 0; i < active; i++) {
+        int index = (target + i) % active;
+        if (m_workqueues[index]->lane(lane).push(item)) {
+            wakeup(index);
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T>
+int threadpool<T>::append_bulk(T** requests, int count){
+    // requests sorted by worker and lane, kept across calls to reuse the memory.
+    static thread_local std::vector<std::vector<task>> buckets;
+    static thread_local std::vector<int> used;
+    if (buckets.size() < (size_t) (m_max_thread_number * LANES)) buckets.resize(m_max_thread_number * LANES);
+
+    task item;
+    item.enqueue_ns = now_ns();
+    int active = m_active.load(std::memory_order_relaxed);
+    unsigned base = m_next_target.load(std::memory_order_relaxed);
+    int fresh = 0; // requests no worker has served yet, handed out POP_BATCH at a time.
+    for(int i = 0; i < count; i++) {
+        item.request = requests[i];
+        int target = requests[i]->m_last_worker;
+        if (target < 0 || target >= active) {
+            target = (int) ((base + fresh++ / POP_BATCH) % active);
+        }
+        int bucket = target * LANES + (requests[i]->m_priority == 0 ? 0 : 1);
+        if (buckets[bucket].empty()) used.push_back(bucket);
+        buckets[bucket].push_back(item);
+    }
+    if (fresh > 0) m_next_target += (fresh + POP_BATCH - 1) / POP_BATCH;
+
+    int failed = 0;
+    for(int bucket : used) {
+        std::vector<task> &tasks = buckets[bucket];
+        int target = bucket / LANES, lane = bucket % LANES;
+        size_t pushed = m_workqueues[target]->lane(lane).push_bulk(tasks.data(), tasks.size());
+        if (pushed > 0) wakeup(target, (int) pushed);
+        // the queue is full, spread the rest over the others.
+        for(size_t i = pushed; i < tasks.size(); i++) {
+            if (!push_task(tasks[i], target, lane, active)) requests[failed++] = tasks[i].request;
+        }
+        tasks.clear();
+    }
+    used.clear();
+    m_shed_full += failed;
+    return failed;
+}
+
+// count requests were queued at target: wake its owner if it sleeps, and more sleeping workers
+// to steal if there are more requests than the owner takes at once. No syscall while every
+// worker is busy.
+template<typename T>
+void threadpool<T>::wakeup(int target, int count){
+    std::atomic_thread_fence(std::memory_order_seq_cst); // orders the push before the m_parked load
+    if (m_parked.load(std::memory_order_relaxed) == 0) return;
+    int wakes = (count + POP_BATCH - 1) / POP_BATCH;
+    if (m_workqueues[target]->idle.waiting()) {
+        m_workqueues[target]->idle.notify_one();
+        if (--wakes == 0) return;
+    }
+    if (m_sticky && target < m_active) return; // nobody else may take them.
+    for(int i = 1; i < m_max_thread_number && wakes > 0; i++) {
+        worker_queue *wq = m_workqueues[(target + i) % m_max_thread_number];
+        if (wq->idle.waiting()) {
+            wq->idle.notify_one();
+            wakes--;
+        }
+    }
+}
+
+template<typename T>
+bool threadpool<T>::append(T* request, typename T::IO_STATE state){
+    // the fd is armed with EPOLLONESHOT, no other thread touches the request until it is re-armed.
+    request->m_io_state = state;
+    return append(request);
+}
+
 template<typename T>
 void* threadpool<T>::worker(void *arg){
+    auto *wq = (worker_queue*) arg;
+    wq->pool->run(wq);
+    return wq;
+}
+
+template<typename T>
+void* threadpool<T>::manager(void *arg){
     auto *pool = (threadpool*) arg;
-    pool->run();
+    pool->manage();
+    return pool;
 }
 
+// try the queues of the other workers once, starting at a random one. Retired workers'
+// queues are included, append() may have raced with the retirement. Sticky workers only
+// take from those.
 template<typename T>
-void threadpool<T>::run(){
-    while(!m_stop){
-        m_queuestat.wait(); // if no value in sem, block in here.
-        m_queuelocker.lock();
-        if (m_workqueue.empty()) {
-            m_queuelocker.unlock();
-            continue;
+bool threadpool<T>::steal(int self, unsigned &seed, int lane, task &item){
+    if (m_max_thread_number == 1) return false;
+    if (m_sticky) {
+        for(int index = m_active; index < m_max_thread_number; index++) {
+            if (m_workqueues[index]->lane(lane).pop(item)) return true;
         }
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
-        m_queuelocker.unlock();
+        return false;
+    }
+    seed ^= seed << 13; // xorshift
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    int victim = (int) (seed % (unsigned) m_max_thread_number);
+    for(int i = 0; i < m_max_thread_number; i++) {
+        int index = (victim + i) % m_max_thread_number;
+        if (index != self && m_workqueues[index]->lane(lane).pop(item)) return true;
+    }
+    return false;
+}
+
+// next requests for worker own: up to POP_BATCH from its own lane, else one stolen from the
+// same lane of the others. Returns how many were taken.
+template<typename T>
+int threadpool<T>::take(worker_queue *own, unsigned &seed, task *items){
+    int first = (++own->dequeues % LOW_LANE_SHARE == 0) ? 1 : 0;
+    for(int i = 0; i < LANES; i++) {
+        int lane = (first + i) % LANES;
+        int n = (int) own->lane(lane).pop_bulk(items, POP_BATCH);
+        if (n > 0) return n;
+        if (steal(own->index, seed, lane, items[0])) return 1;
+    }
+    return 0;
+}
+
+// true if the request waited too long while the queue is overloaded.
+template<typename T>
+bool threadpool<T>::codel_shed(worker_queue *own, uint64_t now, uint64_t wait){
+    if (now >= own->codel_interval_end) {
+        // judge the interval that just ended by its best case, then start a new one.
+        own->codel_overloaded = own->codel_interval_end != 0 && own->codel_min_wait > CODEL_TARGET_NS;
+        own->codel_interval_end = now + CODEL_INTERVAL_NS;
+        own->codel_min_wait = wait;
+    } else if (wait < own->codel_min_wait) {
+        own->codel_min_wait = wait;
+    }
+    return own->codel_overloaded && wait > 2 * CODEL_TARGET_NS;
+}
+
+template<typename T>
+void threadpool<T>::print_stats(){
+    printf("threadpool: shed %lu late (CoDel), %lu with the queues full.\n",
+           m_shed_late.load(), m_shed_full.load());
+}
 
-        if (!request) continue;
+template<typename T>
+void threadpool<T>::handle(T* request, int self){
+    if (!request) return;
+    request->m_last_worker = self;
 
+    if (!m_worker_io) {
         request->process();
+    } else if (request->m_io_state == T::IO_READ) {
+        if (request->read()) {
+            request->process();
+        } else {
+            request->close_conn();
+        }
+    } else if (!request->write()) {
+        request->close_conn();
+    }
+}
+
+template<typename T>
+void threadpool<T>::run(worker_queue *own){
+    int self = own->index;
+    unsigned seed = 2654435761u * (unsigned) (self + 1);
+    task items[POP_BATCH];
+    while(!m_stop && self < m_active){
+        int n = take(own, seed, items);
+        if (n == 0) {
+            // check once more after announcing ourselves, an append() in between wakes us up.
+            unsigned key = own->idle.prepare_wait();
+            m_parked++;
+            if ((n = take(own, seed, items)) > 0 || m_stop || self >= m_active) {
+                m_parked--;
+                own->idle.cancel_wait();
+                if (m_stop || self >= m_active) break;
+            } else {
+                uint64_t start = now_ns();
+                own->parked_since.store(start, std::memory_order_relaxed);
+                own->idle.wait(key); // if there is no work anywhere, block in here.
+                own->idle_ns.store(own->idle_ns.load(std::memory_order_relaxed) + now_ns() - start,
+                                   std::memory_order_relaxed);
+                own->parked_since.store(0, std::memory_order_relaxed);
+                m_parked--;
+                continue;
+            }
+        }
 
+        for(int i = 0; i < n; i++) {
+            uint64_t now = now_ns();
+            uint64_t wait = now - items[i].enqueue_ns;
+            own->wait_ns.store(own->wait_ns.load(std::memory_order_relaxed) + wait, std::memory_order_relaxed);
+            own->waits.store(own->waits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            // a response that is ready to be written is never dropped.
+            if (codel_shed(own, now, wait) && (!m_worker_io || items[i].request->m_io_state == T::IO_READ)) {
+                items[i].request->reject();
+                m_shed_late++;
+                continue;
+            }
+            handle(items[i].request, self);
+        }
+    }
+
+    // retired: nothing new is pushed here anymore, finish what is left.
+    task item;
+    while(!m_stop && (own->high.pop(item) || own->low.pop(item))) {
+        handle(item.request, self);
     }
 }
 
+template<typename T>
+void threadpool<T>::manage(){
+    m_manager_locker.lock();
+    while(!m_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline); // the clock of pthread_cond_timedwait
+        deadline.tv_nsec += MANAGE_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        m_manager_cond.timedwait(m_manager_locker.get(), deadline);
+        if (m_stop) break;
+        adjust();
+    }
+    m_manager_locker.unlock();
+}
+
+// one step of the sizing, every MANAGE_INTERVAL_MS.
+template<typename T>
+void threadpool<T>::adjust(){
+    uint64_t now = now_ns();
+    uint64_t wait_ns = 0, waits = 0, idle_ns = 0;
+    for(int i = 0; i < m_max_thread_number; i++) {
+        worker_queue *wq = m_workqueues[i];
+        uint64_t total_wait = wq->wait_ns.load(std::memory_order_relaxed);
+        uint64_t total_waits = wq->waits.load(std::memory_order_relaxed);
+        // the current sleep counts up to now, approximate while the worker wakes up.
+        uint64_t parked_since = wq->parked_since.load(std::memory_order_relaxed);
+        uint64_t total_idle = wq->idle_ns.load(std::memory_order_relaxed)
+                              + (parked_since && parked_since < now ? now - parked_since : 0);
+        wait_ns += total_wait - wq->last_wait_ns;
+        waits += total_waits - wq->last_waits;
+        if (total_idle > wq->last_idle_ns) idle_ns += total_idle - wq->last_idle_ns;
+        wq->last_wait_ns = total_wait;
+        wq->last_waits = total_waits;
+        wq->last_idle_ns = total_idle;
+    }
+
+    int active = m_active;
+    uint64_t mean_wait = waits ? wait_ns / waits : 0;
+    // idle enough to retire one: the others would still sleep most of the time without it.
+    uint64_t interval_ns = (uint64_t) MANAGE_INTERVAL_MS * 1000000;
+    bool idle = active > 1 && idle_ns > interval_ns
+                && (idle_ns - interval_ns) * 100 / (interval_ns * (active - 1)) > SHRINK_IDLE_PERCENT;
+    m_idle_intervals = idle ? m_idle_intervals + 1 : 0;
+    if (m_cooldown > 0) {
+        m_cooldown--;
+        return;
+    }
+    if (mean_wait > GROW_WAIT_NS && active < m_max_thread_number) {
+        // requests queue up: add a quarter more, at least one.
+        int target = active + (active / 4 > 0 ? active / 4 : 1);
+        if (target > m_max_thread_number) target = m_max_thread_number;
+        for(int i = active; i < target; i++) {
+            if (!start_worker(i)) break;
+        }
+        m_idle_intervals = 0;
+        m_cooldown = COOLDOWN_INTERVALS;
+    } else if (m_idle_intervals >= SHRINK_IDLE_INTERVALS && active > m_thread_number) {
+        // most of the time asleep: retire the last worker, it drains its queue before it leaves.
+        worker_queue *wq = m_workqueues[active - 1];
+        m_active = active - 1;
+        printf("Stopping the %d th thread...\n", active - 1);
+        wq->idle.notify_all();
+        pthread_join(wq->thread, nullptr);
+        wq->running = false;
+        wq->dequeues = 0;
+        m_idle_intervals = 0;
+        m_cooldown = COOLDOWN_INTERVALS;
+    }
+}
+
+template<typename T>
+std::atomic<unsigned long> threadpool<T>::m_shed_late(0);
+template<typename T>
+std::atomic<unsigned long> threadpool<T>::m_shed_full(0);
+
 #endif //WEBSERVER_THREADPOOL_H
@@ -0,0 +1,87 @@
+#include "topology.h"
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+bool parse_cpu_list(const char *text, std::vector<int> &cpus) {
+    cpus.clear();
+    const char *p = text;
+    while(*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE) return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE) return false;
+            p = end;
+        }
+        for(long cpu = first; cpu <= last; cpu++) cpus.push_back((int) cpu);
+        if (*p == ',') p++;
+        else if (*p) return false;
+    }
+    return !cpus.empty();
+}
+
+bool pin_thread(pthread_t thread, int cpu) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return pthread_setaffinity_np(thread, sizeof cpuset, &cpuset) == 0;
+}
+
+int cpu_to_node(int cpu) {
+    // the cpu directory has a nodeN link for the node it is on.
+    char path[64];
+    snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir) return 0;
+    int node = 0;
+    struct dirent *entry;
+    while((entry = readdir(dir)) != nullptr) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+int numa_node_count() {
+    // "0" or "0-1"
+    FILE *fp = fopen("/sys/devices/system/node/possible", "r");
+    if (!fp) return 1;
+    char buf[64] = {0};
+    int count = 1;
+    if (fgets(buf, sizeof buf, fp)) {
+        std::vector<int> nodes;
+        if (parse_cpu_list(strtok(buf, "\n"), nodes)) count = nodes.back() + 1;
+    }
+    fclose(fp);
+    return count;
+}
+
+void* alloc_on_node(size_t size, int node) {
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) return nullptr;
+    if (node >= 0 && node < (int) (sizeof(unsigned long) * 8)) {
+        // set before the first touch, pages are placed when they are faulted in.
+        unsigned long nodemask = 1UL << node;
+        if (syscall(SYS_mbind, addr, size, MPOL_PREFERRED, &nodemask, sizeof nodemask * 8, 0) != 0) {
+            printf("Failed to bind memory to NUMA node %d.\n", node);
+        }
+    }
+    return addr;
+}
+
+void free_on_node(void *addr, size_t size) {
+    if (addr) munmap(addr, size);
+}
@@ -0,0 +1,28 @@
+#ifndef WEBSERVER_TOPOLOGY_H
+#define WEBSERVER_TOPOLOGY_H
+
+#include <pthread.h>
+#include <cstddef>
+#include <vector>
+
+// CPU and NUMA placement helpers. Everything degrades to a no-op on machines (or kernels)
+// without NUMA: one node, memory from anywhere.
+
+// parse a cpu list like "0-3,8,10-11" (the format of /sys and taskset -c).
+bool parse_cpu_list(const char *text, std::vector<int> &cpus);
+
+// pin a thread to one cpu, false if it failed (cpu offline or not in the cpuset).
+bool pin_thread(pthread_t thread, int cpu);
+
+// the NUMA node a cpu belongs to, 0 if unknown.
+int cpu_to_node(int cpu);
+
+// number of NUMA nodes, at least 1.
+int numa_node_count();
+
+// anonymous memory whose pages are preferably placed on node, node < 0 for no preference.
+// Released with free_on_node().
+void* alloc_on_node(size_t size, int node);
+void free_on_node(void *addr, size_t size);
+
+#endif //WEBSERVER_TOPOLOGY_H
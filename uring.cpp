@@ -0,0 +1,498 @@
+#include "uring.h"
+#include "topology.h"
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <exception>
+
+static int io_uring_setup(unsigned entries, io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int ringfd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, ringfd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+static int io_uring_register(int ringfd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, ringfd, opcode, arg, nr_args);
+}
+
+static inline uint64_t make_user_data(int op, int fd) {
+    return ((uint64_t) op << 32) | (uint32_t) fd;
+}
+
+static const int unregistered_slot = -1; // read by IORING_OP_FILES_UPDATE on close.
+
+bool uring_loop::supported() {
+    io_uring_params p;
+    memset(&p, 0, sizeof p);
+    int ringfd = io_uring_setup(8, &p); // ENOSYS on old kernels, EPERM if disabled by sysctl.
+    if (ringfd < 0) return false;
+
+    const int nr_ops = 256;
+    size_t len = sizeof(io_uring_probe) + nr_ops * sizeof(io_uring_probe_op);
+    auto *probe = (io_uring_probe*) calloc(1, len);
+    bool ok = probe && io_uring_register(ringfd, IORING_REGISTER_PROBE, probe, nr_ops) == 0;
+    const int needed[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_FILES_UPDATE,
+                           IORING_OP_ASYNC_CANCEL };
+    for(int op : needed) {
+        if (!ok) break;
+        ok = op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    close(ringfd);
+    if (!ok) return false;
+
+    // the flags have no probe: multishot accept and provided buffer rings are 5.19, a loop
+    // registers its buffer ring or throws. Multishot recv is 6.0, older kernels fail it.
+    try {
+        uring_loop loop(nullptr, 16, -1);
+        return loop.probe_recv();
+    } catch(...) {
+        return false;
+    }
+}
+
+bool uring_loop::probe_recv() {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, sv) != 0) return false;
+    bool ok = false;
+    io_uring_sqe *sqe = get_sqe();
+    if (sqe && send(sv[1], "x", 1, MSG_NOSIGNAL) == 1) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = sv[0];
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->user_data = make_user_data(OP_RECV, sv[0]);
+        // the byte is there already, the recv completes at once.
+        if (submit_and_wait(1) >= 0 && __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE) != *m_cq_head) {
+            ok = m_cqes[*m_cq_head & *m_cq_mask].res == 1;
+        }
+    }
+    close(sv[0]);
+    close(sv[1]);
+    return ok;
+}
+
+uring_loop::uring_loop(http_conn *users, int max_fd, int listenfd, int cpu, int accept_budget):
+        m_users(users), m_max_fd(max_fd), m_listenfd(listenfd), m_cpu(cpu),
+        m_acceptor(listenfd, max_fd, accept_budget), m_accept_pending(false), m_thread(0), m_conns(max_fd),
+        m_ringfd(-1), m_sq_ptr(MAP_FAILED), m_cq_ptr(MAP_FAILED), m_sqes((io_uring_sqe*) MAP_FAILED),
+        m_buf_ring((io_uring_buf_ring*) MAP_FAILED), m_bufs((char*) MAP_FAILED), m_buf_tail(0), m_fixed_files(0) {
+    io_uring_params p;
+    memset(&p, 0, sizeof p);
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = RING_ENTRIES * 4; // multishot operations post many completions per submission.
+    m_ringfd = io_uring_setup(RING_ENTRIES, &p);
+    if (m_ringfd < 0) {
+        throw std::exception();
+    }
+
+    // map the submission and completion rings shared with the kernel.
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (m_cq_size > m_sq_size) m_sq_size = m_cq_size;
+        m_cq_size = m_sq_size;
+    }
+    m_sq_ptr = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    m_ringfd, IORING_OFF_SQ_RING);
+    if (m_sq_ptr == MAP_FAILED) {
+        release_ring();
+        throw std::exception();
+    }
+    m_cq_ptr = m_sq_ptr;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        m_cq_ptr = mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        m_ringfd, IORING_OFF_CQ_RING);
+    }
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = (io_uring_sqe*) mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                  m_ringfd, IORING_OFF_SQES);
+    if (m_cq_ptr == MAP_FAILED || m_sqes == MAP_FAILED) {
+        release_ring();
+        throw std::exception();
+    }
+    char *sq = (char*) m_sq_ptr;
+    m_sq_head = (unsigned*) (sq + p.sq_off.head);
+    m_sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    m_sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+    m_sq_array = (unsigned*) (sq + p.sq_off.array);
+    m_sq_entries = p.sq_entries;
+    m_sq_local_tail = *m_sq_tail;
+    char *cq = (char*) m_cq_ptr;
+    m_cq_head = (unsigned*) (cq + p.cq_off.head);
+    m_cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    m_cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    // provided buffers: the kernel picks one when data arrives instead of every connection
+    // keeping a recv buffer posted.
+    m_buf_ring = (io_uring_buf_ring*) mmap(nullptr, BUF_COUNT * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    m_bufs = (char*) mmap(nullptr, (size_t) BUF_COUNT * BUF_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof reg);
+    reg.ring_addr = (uint64_t) m_buf_ring;
+    reg.ring_entries = BUF_COUNT;
+    reg.bgid = BUF_GROUP;
+    if (m_buf_ring == MAP_FAILED || m_bufs == MAP_FAILED
+        || io_uring_register(m_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        release_ring();
+        throw std::exception();
+    }
+    for(int i = 0; i < BUF_COUNT; i++) add_buffer(i);
+    __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+
+    // a sparse fixed file table, a socket takes the slot of its fd number while it is open.
+    struct rlimit limit;
+    int nr = m_max_fd;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t) nr) nr = (int) limit.rlim_cur;
+    std::vector<int> slots(nr, -1);
+    if (io_uring_register(m_ringfd, IORING_REGISTER_FILES, slots.data(), nr) == 0) {
+        m_fixed_files = nr;
+    }
+}
+
+uring_loop::~uring_loop() {
+    release_ring();
+}
+
+// also for a constructor that throws half way, run_uring() falls back to epoll then.
+void uring_loop::release_ring() {
+    close(m_ringfd);
+    if (m_bufs != MAP_FAILED) munmap(m_bufs, (size_t) BUF_COUNT * BUF_SIZE);
+    if (m_buf_ring != MAP_FAILED) munmap(m_buf_ring, BUF_COUNT * sizeof(io_uring_buf));
+    if (m_sqes != MAP_FAILED) munmap(m_sqes, m_sqes_size);
+    if (m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr) munmap(m_cq_ptr, m_cq_size);
+    if (m_sq_ptr != MAP_FAILED) munmap(m_sq_ptr, m_sq_size);
+}
+
+bool uring_loop::start() {
+    if (pthread_create(&m_thread, nullptr, worker, this) != 0) {
+        return false;
+    }
+    if (m_cpu >= 0 && !pin_thread(m_thread, m_cpu)) {
+        printf("Failed to pin io_uring loop to cpu %d.\n", m_cpu);
+    }
+    return true;
+}
+
+void uring_loop::join() {
+    pthread_join(m_thread, nullptr);
+}
+
+void* uring_loop::worker(void *arg) {
+    auto *loop = (uring_loop*) arg;
+    loop->run();
+    return loop;
+}
+
+io_uring_sqe* uring_loop::get_sqe() {
+    if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) {
+        // full, hand what we have to the kernel first.
+        submit_and_wait(0);
+        if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries) return nullptr;
+    }
+    unsigned index = m_sq_local_tail & *m_sq_mask;
+    io_uring_sqe *sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+    m_sq_array[index] = index;
+    m_sq_local_tail++;
+    return sqe;
+}
+
+int uring_loop::submit_and_wait(unsigned wait_nr) {
+    __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && wait_nr == 0) return 0;
+    return io_uring_enter(m_ringfd, to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+}
+
+// give buffer bid back to the kernel, published with the next store of the ring tail.
+void uring_loop::add_buffer(int bid) {
+    // not m_buf_ring->bufs: in C++ the flexible array of the uapi header sits behind an empty
+    // struct and is off by one entry, the kernel sees the ring as a plain io_uring_buf array.
+    io_uring_buf *buf = (io_uring_buf*) m_buf_ring + (m_buf_tail & (BUF_COUNT - 1));
+    buf->addr = (uint64_t) (m_bufs + (size_t) bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = (unsigned short) bid;
+    m_buf_tail++;
+}
+
+void uring_loop::arm_accept() {
+    io_uring_sqe *sqe = get_sqe();
+    // nothing would arm it again: a multishot accept only completes for good when it stops.
+    m_accept_pending = !sqe;
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = make_user_data(OP_ACCEPT, m_listenfd);
+}
+
+void uring_loop::arm_recv(int fd) {
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe) {
+        start_close(fd);
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd; // the fixed file index is the fd number.
+    sqe->flags = IOSQE_BUFFER_SELECT | (m_conns[fd].fixed ? IOSQE_FIXED_FILE : 0);
+    sqe->buf_group = BUF_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = make_user_data(OP_RECV, fd);
+    m_conns[fd].recv_armed = true;
+}
+
+// a client that keeps sending while it reads its responses slowly: don't take more than the read
+// buffer has room for, TCP flow control holds the rest back.
+void uring_loop::pause_recv(int fd) {
+    conn_state &conn = m_conns[fd];
+    if (conn.recv_paused || conn.closing || (int) conn.pending.size() < m_users[fd].read_room()) return;
+    conn.recv_paused = true;
+    if (!conn.recv_armed || conn.recv_cancelled) return;
+    io_uring_sqe *sqe = get_sqe();
+    if (!sqe) return; // completions that are on the way are kept anyway.
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = make_user_data(OP_RECV, fd);
+    sqe->user_data = make_user_data(OP_CANCEL, fd);
+    conn.recv_cancelled = true;
+}
+
+void uring_loop::resume_recv(int fd) {
+    conn_state &conn = m_conns[fd];
+    if (!conn.recv_paused || conn.closing || (int) conn.pending.size() >= m_users[fd].read_room()) return;
+    conn.recv_paused = false;
+    // a recv still armed is on its way out, its final completion arms it again.
+    if (!conn.recv_armed) arm_recv(fd);
+}
+
+void uring_loop::open_conn(int connfd) {
+    struct sockaddr_in client_address;
+    memset(&client_address, 0, sizeof client_address); // multishot accept doesn't report it.
+    m_users[connfd].init(connfd, client_address, -1);
+
+    conn_state &conn = m_conns[connfd];
+    conn.fixed = false;
+    conn.recv_armed = false;
+    conn.recv_paused = false;
+    conn.recv_cancelled = false;
+    conn.closing = false;
+    conn.send_failed = false;
+    conn.sends_inflight = 0;
+    conn.write_ret = 0;
+    conn.pending.clear();
+
+    if (connfd < m_fixed_files) {
+        // register the socket, linked so the recv only starts once the slot is filled.
+        io_uring_sqe *sqe = get_sqe();
+        if (sqe) {
+            conn.file_slot = connfd;
+            sqe->opcode = IORING_OP_FILES_UPDATE;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t) &conn.file_slot;
+            sqe->len = 1;
+            sqe->off = (uint64_t) connfd;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = make_user_data(OP_REGISTER, connfd);
+            conn.fixed = true;
+        }
+    }
+    arm_recv(connfd);
+}
+
+// header and file body as two sends, the body linked to the header so they go out in order.
+void uring_loop::send_response(int fd) {
+    conn_state &conn = m_conns[fd];
+    struct iovec *iv;
+    int count = m_users[fd].write_iov(&iv);
+    int last = count - 1;
+    while(last >= 0 && iv[last].iov_len == 0) last--;
+    io_uring_sqe *prev = nullptr;
+    for(int i = 0; i < count; i++) {
+        if (iv[i].iov_len == 0) continue;
+        io_uring_sqe *sqe = get_sqe();
+        if (!sqe) {
+            conn.send_failed = true;
+            break;
+        }
+        if (prev) prev->flags |= IOSQE_IO_LINK;
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->flags = conn.fixed ? IOSQE_FIXED_FILE : 0;
+        sqe->addr = (uint64_t) iv[i].iov_base;
+        sqe->len = (unsigned) iv[i].iov_len;
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL; // the kernel retries short sends itself.
+        // all but the last: a small body must not wait for the ACK of its head (Nagle).
+        if (i < last) sqe->msg_flags |= MSG_MORE;
+        sqe->user_data = make_user_data(OP_SEND, fd);
+        conn.sends_inflight++;
+        prev = sqe;
+    }
+    if (conn.sends_inflight == 0) start_close(fd);
+}
+
+void uring_loop::handle_request(int fd) {
+    int ret = m_users[fd].prepare_response();
+    if (ret > 0) send_response(fd);
+    else if (ret < 0) start_close(fd);
+    // 0: wait for the rest of the request.
+}
+
+void uring_loop::start_close(int fd) {
+    conn_state &conn = m_conns[fd];
+    if (conn.closing) return;
+    conn.closing = true;
+    if (conn.recv_armed) {
+        io_uring_sqe *sqe = get_sqe();
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = make_user_data(OP_RECV, fd);
+            sqe->user_data = make_user_data(OP_CANCEL, fd);
+        }
+    }
+    finish_close(fd);
+}
+
+// the fd is only closed once the kernel has no operation on it anymore, so its number cannot be
+// reused while stale completions are still on the way.
+void uring_loop::finish_close(int fd) {
+    conn_state &conn = m_conns[fd];
+    if (!conn.closing || conn.recv_armed || conn.sends_inflight > 0) return;
+    if (conn.fixed) {
+        io_uring_sqe *sqe = get_sqe();
+        if (sqe) {
+            sqe->opcode = IORING_OP_FILES_UPDATE;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t) &unregistered_slot;
+            sqe->len = 1;
+            sqe->off = (uint64_t) fd;
+            sqe->user_data = make_user_data(OP_UNREGISTER, fd);
+        }
+        conn.fixed = false;
+    }
+    conn.closing = false;
+    conn.pending.clear();
+    m_users[fd].close_conn();
+}
+
+void uring_loop::handle_accept(const io_uring_cqe *cqe) {
+    if (cqe->res >= 0) {
+        if (m_acceptor.admit(cqe->res)) open_conn(cqe->res);
+    } else if (cqe->res == -EMFILE || cqe->res == -ENFILE) {
+        // refuse the waiting connection the way the epoll loops do, with the spare fd.
+        m_acceptor.accept_conns([this](int connfd, const sockaddr_in &) { open_conn(connfd); });
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE)) arm_accept();
+}
+
+void uring_loop::handle_recv(int fd, const io_uring_cqe *cqe) {
+    conn_state &conn = m_conns[fd];
+    if (cqe->res > 0 && !conn.closing) {
+        const char *data = m_bufs + (size_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT) * BUF_SIZE;
+        if (conn.sends_inflight > 0 || !conn.pending.empty()) {
+            conn.pending.append(data, cqe->res); // next request, parsed once the response is out.
+        } else {
+            // what doesn't fit waits until the requests in the buffer are answered.
+            int taken = m_users[fd].fill_read(data, cqe->res);
+            conn.pending.append(data + taken, cqe->res - taken);
+            handle_request(fd);
+        }
+        pause_recv(fd);
+    }
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        add_buffer(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+    }
+    if (cqe->flags & IORING_CQE_F_MORE) return;
+
+    // the multishot recv has ended.
+    conn.recv_armed = false;
+    bool cancelled = conn.recv_cancelled;
+    conn.recv_cancelled = false;
+    if (conn.closing) {
+        finish_close(fd);
+    } else if (cqe->res == -ECANCELED && !cancelled) {
+        conn.fixed = false; // the linked registration failed, use the plain fd.
+        arm_recv(fd);
+    } else if (cqe->res > 0 || cqe->res == -ENOBUFS || cqe->res == -ECANCELED) {
+        if (!conn.recv_paused) arm_recv(fd); // else resume_recv() does.
+    } else {
+        start_close(fd); // peer closed or error.
+    }
+}
+
+void uring_loop::handle_send(int fd, const io_uring_cqe *cqe) {
+    conn_state &conn = m_conns[fd];
+    conn.sends_inflight--;
+    if (cqe->res > 0) {
+        conn.write_ret = m_users[fd].on_write(cqe->res);
+    } else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        conn.send_failed = true; // a cancelled body send after a short header send is resent below.
+    }
+    if (conn.sends_inflight > 0) return;
+
+    if (conn.closing) {
+        finish_close(fd);
+    } else if (conn.send_failed || conn.write_ret < 0) {
+        start_close(fd);
+    } else if (conn.write_ret > 0) {
+        send_response(fd); // the rest of a short send.
+    } else {
+        // keep-alive: pipelined requests may be left in the read buffer, and more may have
+        // arrived while the responses were being sent.
+        if (!conn.pending.empty()) {
+            conn.pending.erase(0, m_users[fd].fill_read(conn.pending.data(), (int) conn.pending.size()));
+        }
+        handle_request(fd);
+        resume_recv(fd);
+    }
+}
+
+void uring_loop::handle_cqe(const io_uring_cqe *cqe) {
+    int op = (int) (cqe->user_data >> 32);
+    int fd = (int) (uint32_t) cqe->user_data;
+    switch(op) {
+        case OP_ACCEPT:
+            handle_accept(cqe);
+            break;
+        case OP_RECV:
+            handle_recv(fd, cqe);
+            break;
+        case OP_SEND:
+            handle_send(fd, cqe);
+            break;
+        case OP_REGISTER:
+            // on failure the linked recv is cancelled and re-armed on the plain fd.
+            if (cqe->res < 0) m_conns[fd].fixed = false;
+            break;
+        default: // OP_UNREGISTER, OP_CANCEL
+            break;
+    }
+}
+
+void uring_loop::run() {
+    arm_accept();
+    while(true) {
+        // submit everything queued by the last batch and wait for the next completion in one syscall.
+        int ret = submit_and_wait(1);
+        if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            printf("io_uring failure.\n");
+            break;
+        }
+        if (m_accept_pending) arm_accept(); // the ring has room again.
+
+        unsigned head = *m_cq_head;
+        unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+        for(; head != tail; head++) {
+            handle_cqe(&m_cqes[head & *m_cq_mask]);
+        }
+        __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    }
+}
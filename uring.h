@@ -0,0 +1,109 @@
+#ifndef WEBSERVER_URING_H
+#define WEBSERVER_URING_H
+
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "http_conn.h"
+#include "acceptor.h"
+
+/*
+ * class uring_loop
+ * io_uring counterpart of reactor: one thread, one ring, one listening socket.
+ * The listening socket is served by a multishot accept, every connection by a
+ * multishot recv into a ring of provided buffers, and a response goes out as a
+ * header send linked to the file body send. Sockets are registered as fixed
+ * files at their fd index. All submissions of a loop iteration go to the kernel
+ * together with the wait for completions in a single io_uring_enter().
+ */
+class uring_loop {
+public:
+    uring_loop(http_conn *users, int max_fd, int listenfd, int cpu = -1,
+               int accept_budget = acceptor::DEFAULT_BUDGET);
+    ~uring_loop();
+
+    // true if the kernel has io_uring and the operations used here, checked once at startup.
+    static bool supported();
+
+    bool start(); // create the loop thread
+    void join();
+
+private:
+    // what a completion belongs to, kept in the upper half of user_data; the lower half is the fd.
+    enum OP { OP_ACCEPT = 1, OP_RECV, OP_SEND, OP_REGISTER, OP_UNREGISTER, OP_CANCEL };
+
+    struct conn_state {
+        bool fixed; // registered in the fixed file table at index fd.
+        bool recv_armed; // a multishot recv is outstanding.
+        bool recv_paused; // pending is full, the recv is cancelled until there is room again.
+        bool recv_cancelled; // by pause_recv(), its final completion is no failed registration.
+        bool closing; // close once no operation is outstanding anymore.
+        bool send_failed;
+        int sends_inflight;
+        int write_ret; // last http_conn::on_write() result.
+        int file_slot; // fd passed to IORING_OP_FILES_UPDATE, read by the kernel.
+        std::string pending; // received, not in the read buffer yet: a response was in flight or it was full.
+    };
+
+    static void* worker(void *arg);
+    void run();
+    // true if a multishot recv into the provided buffers gets data, on a loop of its own.
+    bool probe_recv();
+
+    void release_ring(); // close the ring and unmap whatever of it and the buffers is mapped.
+    io_uring_sqe* get_sqe();
+    int submit_and_wait(unsigned wait_nr);
+    void add_buffer(int bid);
+
+    void arm_accept(); // sets m_accept_pending if the ring is full.
+    void arm_recv(int fd);
+    void pause_recv(int fd);
+    void resume_recv(int fd);
+    void send_response(int fd);
+    void handle_request(int fd);
+    void start_close(int fd);
+    void finish_close(int fd);
+    void open_conn(int connfd);
+
+    void handle_cqe(const io_uring_cqe *cqe);
+    void handle_accept(const io_uring_cqe *cqe);
+    void handle_recv(int fd, const io_uring_cqe *cqe);
+    void handle_send(int fd, const io_uring_cqe *cqe);
+
+private:
+    static const unsigned RING_ENTRIES = 4096;
+    static const int BUF_GROUP = 0;
+    static const int BUF_COUNT = 1024; // power of 2
+    static const int BUF_SIZE = 4096;
+
+    http_conn *m_users; // connection table shared by all loops, indexed by fd.
+    int m_max_fd;
+    int m_listenfd;
+    int m_cpu;
+    acceptor m_acceptor;
+    bool m_accept_pending; // the multishot accept is to be armed again, see run().
+    pthread_t m_thread;
+    std::vector<conn_state> m_conns;
+
+    int m_ringfd;
+    void *m_sq_ptr;
+    size_t m_sq_size;
+    void *m_cq_ptr;
+    size_t m_cq_size;
+    io_uring_sqe *m_sqes;
+    size_t m_sqes_size;
+    unsigned *m_sq_head, *m_sq_tail, *m_sq_mask, *m_sq_array;
+    unsigned m_sq_entries;
+    unsigned m_sq_local_tail; // sqes filled in but not yet published to the kernel.
+    unsigned *m_cq_head, *m_cq_tail, *m_cq_mask;
+    io_uring_cqe *m_cqes;
+
+    io_uring_buf_ring *m_buf_ring; // provided buffers for recv.
+    char *m_bufs;
+    unsigned short m_buf_tail;
+    int m_fixed_files; // size of the registered file table, 0 if not available.
+};
+
+#endif //WEBSERVER_URING_H